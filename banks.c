@@ -7,11 +7,42 @@ drawn connect-a-dot and terminated with 0 0 0. Z upward is negative.
 
 Compile:
 
-gcc -ansi banks.c -lm -lX11 -o banks
+gcc -ansi banks.c -lm -lX11 -lXext -pthread -lrt -o banks
 
 Run:
 
-cat horizon.scene pittsburgh.scene | ./banks
+./banks horizon.scene pittsburgh.scene
+
+or, without hot-reload, cat horizon.scene pittsburgh.scene | ./banks
+
+Scene files named on the command line are watched. Save one and it is
+reloaded on the fly, mid-flight (Linux only, uses inotify).
+
+Options:
+
+-g WxH  initial window size (default 768x384, resizable)
+-f deg  horizontal field of view (default 90)
+-a n    pixel aspect ratio, pixel width / pixel height (default 1)
+-j n    rasterizer threads (default one per online core)
+-n n    AI aircraft to fly around you (default 0)
+-v list views to show, from forward,left,right,chase,map (default forward)
+-m ft   ground distance across the map view (default 20000)
+-H      hidden-line mode: solid faces hide the lines behind them, to
+        within a few pixels of their edges. Frames get faster where much
+        is hidden, and cost about the same elsewhere.
+
+Faces:
+
+An object ended with 1 -1 0 instead of 0 0 0, whose last point repeats
+its first, is a flat convex face, e.g. a building wall. It is never
+drawn, so its edges need lines of their own; in hidden-line mode it
+hides what is behind it. Any point summing to 0 ends an object, so other
+readers just see a line. sceneopt -f adds faces to wireframe buildings.
+
+Telemetry:
+
+Every physics tick the flight state is published to POSIX shared memory
+(see telemetry.h). telemetry_reader.c shows it and measures the latency.
 
 Get the .scene data files from the IOCCC site.
 
@@ -83,11 +114,31 @@ makes a sequence of statements. The last one is the value of the
 
 */
 
+#define _XOPEN_SOURCE 600 /* POSIX threads, shm and getopt under -ansi */
+#define _DARWIN_C_SOURCE  /* ...without hiding _SC_NPROCESSORS_ONLN on macOS */
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "telemetry.h"
 
 /* Keyboard symbols we accept. Originally were -D defines on compile line. */
 
@@ -166,18 +217,15 @@ double  airplaneX,
         T, Z, 
         D = 1, 
         d, 
-        worldZ[999], 
         E, 
         speed = 8, 
         I, 
         up_down, 
         accel, 
-        worldY[999], 
         M, m, 
         compassRadians;
 
-double  worldX[999], 
-        forwardTiltRadians = 33e-3, 
+double  forwardTiltRadians = 33e-3, 
         airplaneZ = 1E3, 
         t, 
         left_right, 
@@ -207,7 +255,6 @@ double  cos_compass,
 
 int     N, x, 
         integerConvert, 
-        num_pts, 
         speedKnots, 
         idx;
 
@@ -219,24 +266,599 @@ Window win;
 
 char infoStr[52];
 
+TelemetryPage *telemetry; /* 0 if shared memory could not be set up. */
+TelemetryState telemetryState;
+
 GC gc; /* X Window System graphics context */
 
+/* Scenery.
+
+Each scene file is loaded into its own chunk: its points plus their
+screen positions for the current frame. A file's chunk is never changed
+once the render loop has it. When a file is edited the watcher thread parses
+it into a new chunk and leaves it in pending; the main thread swaps it
+in between frames, so only that file's data is rebuilt and a frame never
+sees half of it. Lines don't join across files, as each file ends its
+last object anyway. */
+
+#define MAX_SCENE_FILES 64 /* Two of these are kept for the traffic and
+                              our own airplane. */
+
+/* One connect-a-dot list: points start..end-1, not counting the 0 0 0.
+An aircraft model is one object, with its own breaks inside. */
+typedef struct {
+    int start, end;
+    int face;           /* Closed outline ended with 1 -1 0. */
+} SceneObject;
+
+/* Where an object landed on screen this frame, in one view. */
+typedef struct {
+    int minX, minY, maxX, maxY; /* minY > maxY if nothing is drawn. */
+    float nearest;              /* Largest 1 / distance of its points. */
+    float farthest;             /* Smallest. */
+} ObjectBounds;
+
+typedef struct {
+    int num_pts;
+    double *worldX, *worldY, *worldZ;
+    int *screenX, *screenY; /* Each vertex projected once per frame, in
+                               each view: view n starts at n * num_pts. */
+    float *invDepth;        /* 1 / distance along the view, same layout. */
+
+    int num_objects;
+    SceneObject *objects;
+    ObjectBounds *bounds;   /* Per view: view n at n * num_objects. */
+} SceneChunk;
+
+typedef struct {
+    const char *path;        /* 0 for stdin. */
+    int dirWatch;            /* inotify watch on the file's directory. */
+    SceneChunk *chunk;       /* In use by the render loop. */
+    SceneChunk *pending;     /* Reloaded, taken at the next frame. */
+} SceneFile;
+
+SceneFile sceneFiles[MAX_SCENE_FILES];
+int num_scene_files;
+
+/* Viewport and camera.
+
+The original projected with x = Dy / Dx * 384 + 64 into a 384 x 128 window,
+a 90 degree view whose center sat 64 pixels in from the top-left corner, so
+most of the picture landed off-screen. The camera is now centered and
+scaled from the window size, so the defaults below give the original
+image scale with all of it visible. */
+
+#define MAX_THREADS 64
+#define TILE_ROWS 32   /* Height of one horizontal screen tile. */
+#define GUARD_BAND 2   /* Keep points this many half-screens out so lines
+                          leaving the edge are clipped, not dropped. */
+#define NOT_DRAWN 10000 /* Screen x of a vertex that starts no line. The
+                           1E4 flag of the original. */
+#define DEPTH_CELL 12   /* Hidden-line mode keeps depth per DEPTH_CELL
+                           square of pixels, not per pixel, so a line
+                           behind a face can show up to a cell in from
+                           the face's edge. */
+#define FACE_NONE 0     /* No face over a box of pixels, */
+#define FACE_HIDES 1    /* faces hide all of it, */
+#define FACE_SOME 2     /* or some of it may be hidden. */
+#define DEPTH_BIAS 0.01 /* A line pixel this fraction of its distance
+                           behind a face still shows, so edges drawn on
+                           the face itself aren't lost. */
+
+int winWidth = 768, winHeight = 384;
+double fovDegrees = 90,   /* Horizontal field of view. */
+       pixelAspect = 1;   /* Pixel width / pixel height. */
+
+/* Views.
+
+The window can show several views of the same frame: the forward view,
+views out of the left and right windows, a chase camera behind the
+airplane and a north-up map. The first view named gets the top two
+thirds of the window, the rest share the bottom third. Every view sees
+each vertex in the same pass, so adding views adds only the per-view
+transform, not another walk over the scenery. */
+
+#define MAX_VIEWS 8
+#define CHASE_BACK 150  /* Chase camera distance behind, feet. */
+#define CHASE_UP 40     /* and above. */
+
+enum { FORWARD_VIEW, LEFT_VIEW, RIGHT_VIEW, CHASE_VIEW, MAP_VIEW };
+
+const char *viewNames[] = {"forward", "left", "right", "chase", "map"};
+
+typedef struct {
+    int kind;
+    int left, top, width, height;    /* Where it sits in the window. */
+    double focalX, focalY, tanHalfFovX, tanHalfFovY;
+    double mapScale;                 /* Map pixels per foot. */
+    double eyeX, eyeY, eyeZ;         /* Camera, eyeZ positive upward. */
+    double R[3][3];                  /* World to camera rotation. */
+} View;
+
+View views[MAX_VIEWS] = {{FORWARD_VIEW}};
+int num_views = 1;
+double mapFeet = 20000; /* Ground distance across the map view. */
+
+SceneChunk *playerChunk; /* Our own airplane, seen only from the chase view. */
+
+unsigned int *frameBuffer, inkPixel, paperPixel;
+XImage *frameImage;
+
+/* MIT-SHM: the frame lives in memory shared with the X server, which
+copies it to the window itself instead of reading it down the socket. */
+int useShm, shmFailed;
+XShmSegmentInfo frameShm;
+
+/* Hidden-line mode. Faces are never drawn; they only hide lines. */
+int hiddenLines;
+
+/* A side of a face on screen. Over the band of DEPTH_CELL rows starting
+at row y the side cuts in no further than x + step * y: x already allows
+for sides that cut in furthest at the band's bottom row. */
+typedef struct {
+    double x, step;
+} FaceEdge;
+
+/* A face on screen in a view this frame. A face is flat, so 1 / distance
+over it is planeX * x + planeY * y + planeC. Its sides, less any level
+ones, are edges firstEdge..firstEdge+numEdges-1 of its list; the face is
+right of the first numLeft of them and left of the rest. */
+typedef struct {
+    ObjectBounds *bounds;
+    double planeX, planeY, planeC;
+    int firstEdge, numLeft, numEdges;
+} FaceRef;
+
+/* Faces on screen this frame, listed by the thread that bounded them:
+thread t's faces in view v are in faceLists[t][v]. */
+typedef struct {
+    FaceRef *faces;
+    int count, size;
+    FaceEdge *edges;
+    int numEdges, edgesSize;
+} FaceList;
+
+/* A tile's depth cells in hidden-line mode: for each DEPTH_CELL square
+of pixels, the farthest 1 / distance of a face covering all of it, less
+DEPTH_BIAS, 0 where none does. Only cells minX..maxX, minY..maxY can be
+other than 0, and none in row cy is more than rowMax[cy]. */
+typedef struct {
+    float *cells;
+    float rowMax[(TILE_ROWS + DEPTH_CELL - 1) / DEPTH_CELL];
+    int cellsX, left, right, top, bottom, minX, minY, maxX, maxY;
+} DepthCells;
+
+FaceList faceLists[MAX_THREADS][MAX_VIEWS];
+
+int numThreads;
+pthread_t workers[MAX_THREADS];
+/* Barrier for the frame steps. macOS has no pthread_barrier_t. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    int count, waiting, lap;
+} FrameBarrier;
+
+FrameBarrier frameStart, frameProjected, frameBounded, frameDone;
+
+void frameBarrierInit(FrameBarrier *b, int count) {
+    pthread_mutex_init(&b->lock, 0);
+    pthread_cond_init(&b->turn, 0);
+    b->count = count;
+    b->waiting = b->lap = 0;
+}
+
+/* Function to wait until all count threads have reached the barrier */
+void frameBarrierWait(FrameBarrier *b) {
+    int lap;
+
+    pthread_mutex_lock(&b->lock);
+    lap = b->lap;
+    if (++b->waiting == b->count) {
+        b->waiting = 0;
+        b->lap++;
+        pthread_cond_broadcast(&b->turn);
+    } else {
+        while (lap == b->lap)
+            pthread_cond_wait(&b->turn, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Function to place the views in the window and set up their cameras
+for its size */
+void layoutViews() {
+    View *view;
+    int i, mainHeight = num_views > 1 ? winHeight * 2 / 3 : winHeight;
+
+    for (i = 0; i < num_views; i++) {
+        view = &views[i];
+        if (i == 0) {
+            view->left = view->top = 0;
+            view->width = winWidth;
+            view->height = mainHeight;
+        } else {
+            view->left = winWidth * (i - 1) / (num_views - 1);
+            view->top = mainHeight;
+            view->width = winWidth * i / (num_views - 1) - view->left;
+            view->height = winHeight - mainHeight;
+        }
+        if (view->width < 1) view->width = 1;
+        if (view->height < 1) view->height = 1;
+
+        view->tanHalfFovX = tan(fovDegrees / 57.3 / 2);
+        view->focalX = view->width / 2 / view->tanHalfFovX;
+        view->focalY = view->focalX * pixelAspect;
+        view->tanHalfFovY = view->height / 2 / view->focalY;
+        view->mapScale = view->width / mapFeet;
+    }
+}
+
+/* Function to fill in a world to camera rotation from the three angles,
+the same matrix calculateAngles() builds for the airplane */
+void rotationFromAngles(double R[3][3], double compass, double forwardTilt, double sideTilt) {
+    double cc = cos(compass), sc = sin(compass), cf = cos(forwardTilt), sf = sin(forwardTilt),
+           cs = cos(sideTilt), ss = sin(sideTilt);
+
+    R[0][0] = cf * cc;
+    R[0][1] = cf * sc;
+    R[0][2] = -sf;
+    R[1][0] = cc * ss * sf - sc * cs;
+    R[1][1] = cs * cc + ss * sc * sf;
+    R[1][2] = ss * cf;
+    R[2][0] = sc * ss + cs * sf * cc;
+    R[2][1] = sf * sc * cs - ss * cc;
+    R[2][2] = cs * cf;
+}
+
+/* Function to point every view's camera for this frame. The side views
+turn the airplane's axes a quarter turn about its vertical; the chase
+camera follows the heading only, so it doesn't roll with the wings. */
+void aimViews() {
+    View *view;
+    double forward;
+    int i;
+
+    for (view = views; view < views + num_views; view++) {
+        view->eyeX = airplaneX;
+        view->eyeY = airplaneY;
+        view->eyeZ = airplaneZ;
+        if (view->kind == CHASE_VIEW) {
+            view->eyeX -= CHASE_BACK * cos(compassRadians);
+            view->eyeY -= CHASE_BACK * sin(compassRadians);
+            view->eyeZ += CHASE_UP;
+            rotationFromAngles(view->R, compassRadians, -atan2(CHASE_UP, CHASE_BACK), 0);
+            continue;
+        }
+
+        view->R[0][0] = R11; view->R[0][1] = R12; view->R[0][2] = R13;
+        view->R[1][0] = R21; view->R[1][1] = R22; view->R[1][2] = R23;
+        view->R[2][0] = R31; view->R[2][1] = R32; view->R[2][2] = R33;
+
+        /* Out the left window, forward is the airplane's left and the
+        nose is to the right. The other way round out the right. */
+        for (i = 0; i < 3; i++) {
+            forward = view->R[0][i];
+            if (view->kind == LEFT_VIEW) {
+                view->R[0][i] = -view->R[1][i];
+                view->R[1][i] = forward;
+            } else if (view->kind == RIGHT_VIEW) {
+                view->R[0][i] = view->R[1][i];
+                view->R[1][i] = -forward;
+            }
+        }
+    }
+}
+
+int catchShmError(Display *disp, XErrorEvent *error) {
+    (void)disp;
+    (void)error;
+    shmFailed = 1;
+    return 0;
+}
+
+/* Function to make a frame image in shared memory, 0 if the server
+can't share it, e.g. over the network */
+XImage *createShmImage(Display *disp, int width, int height) {
+    XImage *image;
+    int (*oldHandler)(Display *, XErrorEvent *);
+
+    image = XShmCreateImage(disp, DefaultVisual(disp, 0), DefaultDepth(disp, 0),
+                            ZPixmap, 0, &frameShm, width, height);
+    if (!image)
+        return 0;
+    if (image->bits_per_pixel != 32 || image->bytes_per_line != width * 4) {
+        XDestroyImage(image);
+        return 0;
+    }
+    frameShm.shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * height, IPC_CREAT | 0600);
+    if (frameShm.shmid < 0) {
+        XDestroyImage(image);
+        return 0;
+    }
+    frameShm.shmaddr = image->data = shmat(frameShm.shmid, 0, 0);
+    frameShm.readOnly = False;
+    if (frameShm.shmaddr == (char *)-1) {
+        shmctl(frameShm.shmid, IPC_RMID, 0);
+        XDestroyImage(image);
+        return 0;
+    }
+
+    /* A refused attach only shows up as an X error. */
+    shmFailed = 0;
+    oldHandler = XSetErrorHandler(catchShmError);
+    XShmAttach(disp, &frameShm);
+    XSync(disp, False);
+    XSetErrorHandler(oldHandler);
+    shmctl(frameShm.shmid, IPC_RMID, 0); /* Goes once both sides detach. */
+    if (shmFailed) {
+        shmdt(frameShm.shmaddr);
+        XDestroyImage(image);
+        return 0;
+    }
+    return image;
+}
+
+/* Function to (re)allocate the off-screen frame for a new window size.
+Lines are rasterized here by the tile workers and blitted in one put,
+which also stops the flicker of drawing straight to the window. The
+frame is shared with the X server when it lets us, else sent with
+XPutImage. */
+void resizeViewport(Display *disp, int width, int height) {
+    if (frameImage && useShm) {
+        XShmDetach(disp, &frameShm);
+        XDestroyImage(frameImage);
+        shmdt(frameShm.shmaddr);
+    } else if (frameImage) {
+        XDestroyImage(frameImage); /* Frees frameBuffer too. */
+    }
+
+    winWidth = width;
+    winHeight = height;
+    frameImage = useShm ? createShmImage(disp, width, height) : 0;
+    if (frameImage) {
+        frameBuffer = (unsigned int *)frameImage->data;
+    } else {
+        useShm = 0;
+        frameBuffer = malloc((size_t)width * height * sizeof *frameBuffer);
+        frameImage = XCreateImage(disp, DefaultVisual(disp, 0), DefaultDepth(disp, 0),
+                                  ZPixmap, 0, (char *)frameBuffer, width, height, 32, 0);
+    }
+    if (!frameBuffer || !frameImage || frameImage->bits_per_pixel != 32) {
+        fprintf(stderr, "banks: need a 24 or 32 bit TrueColor display\n");
+        exit(1);
+    }
+    layoutViews();
+}
+
 /* Function to set up X Windows */
 void setupXWindows(Display **disp, Window *win, GC *gc) {
     *disp = XOpenDisplay(0);
+    if (!*disp) {
+        fprintf(stderr, "banks: cannot open display\n");
+        exit(1);
+    }
     *win = RootWindow(*disp, 0);
     *gc = XCreateGC(*disp, *win, 0, 0);
-    XSetForeground(*disp, *gc, BlackPixel(*disp, 0));
-    *win = XCreateSimpleWindow(*disp, *win, 0, 0, 384, 128, 0, 0, WhitePixel(*disp, 0));
-    XSelectInput(*disp, *win, KeyPressMask);
+    inkPixel = BlackPixel(*disp, 0);
+    paperPixel = WhitePixel(*disp, 0);
+    XSetForeground(*disp, *gc, inkPixel);
+    *win = XCreateSimpleWindow(*disp, *win, 0, 0, winWidth, winHeight, 0, 0, paperPixel);
+    XSelectInput(*disp, *win, KeyPressMask | StructureNotifyMask);
     XMapWindow(*disp, *win);
+    useShm = XShmQueryExtension(*disp);
+    resizeViewport(*disp, winWidth, winHeight);
+}
+
+/* Function to free a chunk */
+void freeChunk(SceneChunk *c) {
+    if (!c)
+        return;
+    free(c->worldX);
+    free(c->worldY);
+    free(c->worldZ);
+    free(c->screenX);
+    free(c->screenY);
+    free(c->invDepth);
+    free(c->objects);
+    free(c->bounds);
+    free(c);
+}
+
+/* Function to make room for a chunk's screen positions in every view */
+int allocScreenPositions(SceneChunk *c) {
+    c->screenX = malloc((size_t)num_views * (c->num_pts + 1) * sizeof(int));
+    c->screenY = malloc((size_t)num_views * (c->num_pts + 1) * sizeof(int));
+    c->invDepth = malloc((size_t)num_views * (c->num_pts + 1) * sizeof(float));
+    return c->screenX && c->screenY && c->invDepth;
+}
+
+/* Function to split a chunk into its objects. Bounding each object once
+a frame lets a tile skip the objects it can't see. */
+int findObjects(SceneChunk *c) {
+    int i, start = 0, n = 0;
+    double *x = c->worldX, *y = c->worldY, *z = c->worldZ;
+
+    c->objects = malloc((c->num_pts + 1) * sizeof *c->objects);
+    if (!c->objects)
+        return 0;
+    for (i = 0; i <= c->num_pts; i++) {
+        if (i < c->num_pts && x[i] + y[i] + z[i] != 0)
+            continue;
+        if (i > start + 1) {
+            c->objects[n].start = start;
+            c->objects[n].end = i;
+            c->objects[n].face = i < c->num_pts && x[i] == 1 && y[i] == -1 && z[i] == 0 &&
+                                 i - start >= 4 && x[start] == x[i - 1] &&
+                                 y[start] == y[i - 1] && z[start] == z[i - 1];
+            n++;
+        }
+        start = i + 1;
+    }
+    c->num_objects = n;
+    c->bounds = malloc(((size_t)num_views * n + 1) * sizeof *c->bounds);
+    return c->bounds != 0;
+}
+
+/* Function to read one scene file into a new chunk, 0 if out of memory */
+SceneChunk *readSceneChunk(FILE *f) {
+    SceneChunk *c = calloc(1, sizeof *c);
+    int cap = 0;
+    double px, py, pz;
+
+    if (!c)
+        return 0;
+    while (fscanf(f, "%lf%lf%lf", &px, &py, &pz) == 3) {
+        if (c->num_pts == cap) {
+            cap = cap ? cap * 2 : 1024;
+            if (!(c->worldX = realloc(c->worldX, cap * sizeof(double))) ||
+                !(c->worldY = realloc(c->worldY, cap * sizeof(double))) ||
+                !(c->worldZ = realloc(c->worldZ, cap * sizeof(double)))) {
+                freeChunk(c);
+                return 0;
+            }
+        }
+        c->worldX[c->num_pts] = px;
+        c->worldY[c->num_pts] = py;
+        c->worldZ[c->num_pts] = pz;
+        c->num_pts++;
+    }
+    if (!allocScreenPositions(c) || !findObjects(c)) {
+        freeChunk(c);
+        return 0;
+    }
+    return c;
+}
+
+/* Function to (re)load a scene file by path */
+SceneChunk *loadSceneFile(const char *path) {
+    FILE *f = fopen(path, "r");
+    SceneChunk *c;
+
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    c = readSceneChunk(f);
+    fclose(f);
+    if (!c)
+        fprintf(stderr, "banks: out of memory loading %s\n", path);
+    return c;
+}
+
+/* Function to load map files into chunks, from the named files or stdin */
+void loadMapFiles(int argc, char **argv) {
+    SceneFile *f;
+
+    if (argc > MAX_SCENE_FILES - 2) {
+        fprintf(stderr, "banks: too many scene files, at most %d\n", MAX_SCENE_FILES - 2);
+        exit(1);
+    }
+    if (argc == 0) {
+        f = &sceneFiles[num_scene_files++];
+        f->chunk = readSceneChunk(stdin);
+    }
+    for (; argc > 0; argc--, argv++) {
+        f = &sceneFiles[num_scene_files++];
+        f->path = *argv;
+        f->chunk = loadSceneFile(*argv);
+    }
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++)
+        if (!f->chunk)
+            exit(1);
+}
+
+/* Function to swap in files reloaded since the last frame. Called
+between frames, when no worker is looking at a chunk. */
+void swapInReloadedScenes() {
+    SceneFile *f;
+    SceneChunk *c;
+
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+        c = __atomic_exchange_n(&f->pending, (SceneChunk *)0, __ATOMIC_ACQUIRE);
+        if (c) {
+            freeChunk(f->chunk);
+            f->chunk = c;
+        }
+    }
+}
+
+#ifdef __linux__
+int inotifyFd;
+
+/* Function to reload a file and hand it to the render loop. Runs on
+the watcher thread, so parsing never holds up a frame. */
+void reloadSceneFile(SceneFile *f) {
+    SceneChunk *c = loadSceneFile(f->path);
+
+    if (!c)
+        return; /* Keep flying the old one. */
+    c = __atomic_exchange_n(&f->pending, c, __ATOMIC_ACQ_REL);
+    freeChunk(c); /* A reload the render loop never got to. */
+    fprintf(stderr, "banks: reloaded %s\n", f->path);
 }
 
-/* Function to load map files from stdin into arrays */
-void loadMapFiles() {
-    /*Load map files from stdin into arrays. */
-    for (; scanf("%lf%lf%lf", worldX + num_pts, worldY + num_pts, worldZ + num_pts) + 1; num_pts++);
+/* Function run by the watcher thread. Directories are watched rather
+than the files, since editors often save by renaming a new file over the
+old one. */
+void *sceneWatcher(void *arg) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event)))), *p;
+    const char *name;
+    struct inotify_event *event;
+    SceneFile *f;
+    ssize_t len;
+
+    (void)arg;
+    for (;;) {
+        len = read(inotifyFd, buf, sizeof buf);
+        if (len <= 0)
+            return 0;
+        for (p = buf; p < buf + len; p += sizeof *event + event->len) {
+            event = (struct inotify_event *)p;
+            if (!event->len)
+                continue;
+            for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+                if (!f->path || f->dirWatch != event->wd)
+                    continue;
+                name = strrchr(f->path, '/');
+                name = name ? name + 1 : f->path;
+                if (!strcmp(name, event->name))
+                    reloadSceneFile(f);
+            }
+        }
+    }
+}
+
+/* Function to watch the scene files' directories and start the watcher */
+void startSceneWatcher() {
+    pthread_t watcher;
+    char dir[4096];
+    const char *slash;
+    SceneFile *f;
+
+    inotifyFd = inotify_init();
+    if (inotifyFd < 0) {
+        perror("banks: inotify");
+        return;
+    }
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+        if (!f->path)
+            continue;
+        slash = strrchr(f->path, '/');
+        if (!slash)
+            strcpy(dir, ".");
+        else
+            snprintf(dir, sizeof dir, "%.*s", (int)(slash - f->path) > 0 ? (int)(slash - f->path) : 1, f->path);
+        f->dirWatch = inotify_add_watch(inotifyFd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (f->dirWatch < 0)
+            perror(dir);
+    }
+    pthread_create(&watcher, 0, sceneWatcher, 0);
+}
+#else
+void startSceneWatcher() {
 }
+#endif
 
 /* Function to sleep for a specified interval */
 void sleepForInterval() {
@@ -305,96 +927,614 @@ void calculateAngles() {
 }
 
 
-/* Function to update the display */
-void updateDisplay(Display *disp, Window win, GC gc) {
+/* Function to shift, rotate and project one world vertex into the
+chunk's screenX/screenY for every view. Everything is local so the tile
+workers can share it. */
+void projectVertex(SceneChunk *c, int idx) {
+    double wx = c->worldX[idx], wy = c->worldY[idx], wz = c->worldZ[idx],
+           rx, ry, rz, dx, dy, dz;
+    int *screenX = c->screenX + idx, *screenY = c->screenY + idx;
+    float *invDepth = c->invDepth + idx;
+    View *view;
+
+    /*0,0,0 signals end of an object, in every view. */
+    if (wx + wy + wz == 0) {
+        for (view = views; view < views + num_views; view++, screenX += c->num_pts)
+            *screenX = NOT_DRAWN;
+        return;
+    }
+
+    for (view = views; view < views + num_views;
+         view++, screenX += c->num_pts, screenY += c->num_pts, invDepth += c->num_pts) {
+        if (c == playerChunk && view->kind != CHASE_VIEW) {
+            *screenX = NOT_DRAWN;
+            continue;
+        }
+
+        /*The world point must be moved so the camera is the 0,0,0 origin.
+        Then the point must be rotated by all 3 angles.
 
-    /* Function to clear the window */
-    void clearWindow(Display *disp, Window win) {
-        XClearWindow(disp, win);
+        Finally the 3D point must be projected onto the 2D plane of the
+        display. All this is the camera transform in
+
+        en.wikipedia.org/wiki/Perspective_transform#Perspective_projection.*/
+
+        /*Shift world object vertex x,y,z relative to camera as origin.
+        The Z line uses + because eyeZ is upward positive. It has to
+        be negated because world Z is upward negative:
+        worldZ – -eyeZ = worldZ + eyeZ. */
+        rx = wx - view->eyeX;
+        ry = wy - view->eyeY;
+        rz = wz + view->eyeZ;
+
+        if (view->kind == MAP_VIEW) {
+            /* Straight down, north up, east to the right. */
+            dx = -rx * view->mapScale;
+            dy = ry * view->mapScale;
+            if (fabs(dy) > view->width / 2 * GUARD_BAND || fabs(dx) > view->height / 2 * GUARD_BAND) {
+                *screenX = NOT_DRAWN;
+                continue;
+            }
+            *screenX = view->left + view->width / 2 + dy;
+            *screenY = view->top + view->height / 2 + dx;
+            *invDepth = 0;
+            continue;
+        }
+
+        /* Apply the 3 angle rotation matrix. */
+        dx = view->R[0][0] * rx + view->R[0][1] * ry + view->R[0][2] * rz;
+        dy = view->R[1][0] * rx + view->R[1][1] * ry + view->R[1][2] * rz;
+        dz = view->R[2][0] * rx + view->R[2][1] * ry + view->R[2][2] * rz;
+
+        /* Points behind the camera or well outside the view are not
+        drawn, nor is the line to the next point. */
+        if (dx <= 0 || fabs(dy) > dx * view->tanHalfFovX * GUARD_BAND ||
+            fabs(dz) > dx * view->tanHalfFovY * GUARD_BAND) {
+            *screenX = NOT_DRAWN;
+            continue;
+        }
+
+        /* The rotation has us looking along the Dx axis, so the farther
+        out Dx is, the smaller Dy and Dz become. */
+        *screenX = view->left + view->width / 2 + dy / dx * view->focalX;
+        *screenY = view->top + view->height / 2 + dz / dx * view->focalY;
+        *invDepth = 1 / dx;
+    }
+}
+
+/* Function to add a face in view n to a list, working out its plane
+and sides. A face seen edge on hides nothing and is left out. */
+void listFace(FaceList *l, SceneChunk *c, int n, SceneObject *o, ObjectBounds *b) {
+    int *screenX = c->screenX + n * c->num_pts + o->start, *screenY = c->screenY + n * c->num_pts + o->start;
+    float *invDepth = c->invDepth + n * c->num_pts + o->start;
+    int i, left, corners = o->end - o->start - 1;
+    double area = 0, cross = 0;
+    FaceRef *f;
+    FaceEdge *e;
+
+    for (i = 0; i < corners; i++)
+        area += (double)screenX[i] * screenY[i + 1] - (double)screenX[i + 1] * screenY[i];
+    for (i = 1; i + 1 < corners && !cross; i++)
+        cross = (double)(screenX[i] - screenX[0]) * (screenY[i + 1] - screenY[0]) -
+                (double)(screenX[i + 1] - screenX[0]) * (screenY[i] - screenY[0]);
+    if (area == 0 || !cross)
+        return;
+    i--;
+
+    if (l->count == l->size) {
+        l->size = l->size ? l->size * 2 : 64;
+        l->faces = realloc(l->faces, l->size * sizeof *l->faces);
+    }
+    while (l->numEdges + corners > l->edgesSize) {
+        l->edgesSize = l->edgesSize ? l->edgesSize * 2 : 256;
+        l->edges = realloc(l->edges, l->edgesSize * sizeof *l->edges);
+    }
+    if (!l->faces || !l->edges) {
+        fprintf(stderr, "banks: out of memory\n");
+        exit(1);
     }
 
-    /* Function to shift world object vertex relative to airplane as origin */
-    void shiftWorldObjectVertex(int idx) {
-        worldX_rel = worldX[idx] - airplaneX;
-        worldY_rel = worldY[idx] - airplaneY;
-        worldZ_rel = worldZ[idx] + airplaneZ;
+    f = &l->faces[l->count++];
+    f->bounds = b;
+    f->planeX = ((invDepth[i] - invDepth[0]) * (screenY[i + 1] - screenY[0]) -
+                 (invDepth[i + 1] - invDepth[0]) * (screenY[i] - screenY[0])) / cross;
+    f->planeY = ((screenX[i] - screenX[0]) * (invDepth[i + 1] - invDepth[0]) -
+                 (screenX[i + 1] - screenX[0]) * (invDepth[i] - invDepth[0])) / cross;
+    f->planeC = invDepth[0] - f->planeX * screenX[0] - f->planeY * screenY[0];
+
+    /* The face is convex, so it is on the inner side of every side.
+    Level sides only cut it off at its top and bottom rows. */
+    f->firstEdge = l->numEdges;
+    for (left = 1; left >= 0; left--) {
+        for (i = 0; i < corners; i++) {
+            if (screenY[i + 1] == screenY[i] || ((screenY[i + 1] < screenY[i]) == (area > 0)) != left)
+                continue;
+            e = &l->edges[l->numEdges++];
+            e->step = (double)(screenX[i + 1] - screenX[i]) / (screenY[i + 1] - screenY[i]);
+            e->x = screenX[i] - e->step * screenY[i];
+            if ((e->step > 0) == left)
+                e->x += e->step * (DEPTH_CELL - 1);
+        }
+        if (left)
+            f->numLeft = l->numEdges - f->firstEdge;
     }
+    f->numEdges = l->numEdges - f->firstEdge;
+}
 
-    /* Function to apply the 3 angle rotation matrix */
-    void applyRotationMatrix() {
-        Dx = R11 * worldX_rel + R12 * worldY_rel + R13 * worldZ_rel;
-        Dy = R21 * worldX_rel + R22 * worldY_rel + R23 * worldZ_rel;
-        Dz = R31 * worldX_rel + R32 * worldY_rel + R33 * worldZ_rel;
+/* Function to bound objects from..to-1 of a chunk on screen, in every
+view. In hidden-line mode the faces wholly in view that reach the screen
+go on thread t's list for the view, so tiles only look at those. */
+void boundObjects(SceneChunk *c, int from, int to, int t) {
+    int v, o, i, culled, *screenX, *screenY;
+    float *invDepth;
+    ObjectBounds *b;
+    View *view;
+
+    for (v = 0; v < num_views; v++) {
+        view = &views[v];
+        screenX = c->screenX + v * c->num_pts;
+        screenY = c->screenY + v * c->num_pts;
+        invDepth = c->invDepth + v * c->num_pts;
+        for (o = from; o < to; o++) {
+            b = &c->bounds[v * c->num_objects + o];
+            b->minX = b->minY = NOT_DRAWN;
+            b->maxX = b->maxY = -NOT_DRAWN;
+            b->nearest = 0;
+            b->farthest = HUGE_VAL;
+            culled = 0;
+            for (i = c->objects[o].start; i < c->objects[o].end; i++) {
+                if (screenX[i] == NOT_DRAWN) {
+                    culled = 1;
+                    continue;
+                }
+                if (screenX[i] < b->minX) b->minX = screenX[i];
+                if (screenX[i] > b->maxX) b->maxX = screenX[i];
+                if (screenY[i] < b->minY) b->minY = screenY[i];
+                if (screenY[i] > b->maxY) b->maxY = screenY[i];
+                if (invDepth[i] > b->nearest) b->nearest = invDepth[i];
+                if (invDepth[i] < b->farthest) b->farthest = invDepth[i];
+            }
+            if (hiddenLines && view->kind != MAP_VIEW && c->objects[o].face && !culled &&
+                b->maxX >= view->left && b->minX < view->left + view->width &&
+                b->maxY >= view->top && b->minY < view->top + view->height)
+                listFace(&faceLists[t][v], c, v, &c->objects[o], b);
+        }
     }
+}
 
-    void project3DPointOnto2DPlane() {
-        /* Project 3D point onto 2D plane to be displayed. This will
-        make distant objects look smaller. The rotation has us
-        looking along the Dx axis, I think. So the farther out Dx
-        is, the smaller Dy and Dz become. The wiki1 article has
-        Dz as the denominator. Why? Is the article wrong? This
-        code is working. */
+/* Function to test cells cx0..cx1, cy0..cy1 of a tile, under pixels
+from nearest to farthest 1 / distance: FACE_NONE if no face there hides
+any of them, FACE_HIDES if faces hide them all, else FACE_SOME. Cells
+past the faces' box are empty. */
+int cellsCover(DepthCells *d, int cx0, int cy0, int cx1, int cy1, float nearest, float farthest) {
+    int cx, cy, shows, hides = 0;
+    float *cell;
+
+    if (cx1 < d->minX || cx0 > d->maxX || cy1 < d->minY || cy0 > d->maxY)
+        return FACE_NONE;
+    shows = cx0 < d->minX || cx1 > d->maxX || cy0 < d->minY || cy1 > d->maxY;
+    if (cx0 < d->minX) cx0 = d->minX;
+    if (cx1 > d->maxX) cx1 = d->maxX;
+    if (cy0 < d->minY) cy0 = d->minY;
+    if (cy1 > d->maxY) cy1 = d->maxY;
+
+    /* Nothing in front of every face here is hidden. */
+    for (cy = cy0; cy <= cy1 && farthest >= d->rowMax[cy]; cy++)
+        ;
+    if (cy > cy1)
+        return FACE_NONE;
+    for (cy = cy0; cy <= cy1; cy++) {
+        cell = d->cells + cy * d->cellsX;
+        for (cx = cx0; cx <= cx1; cx++) {
+            shows |= nearest >= cell[cx];
+            hides |= farthest < cell[cx];
+            if (shows && hides)
+                return FACE_SOME;
+        }
+    }
+    return shows ? FACE_NONE : FACE_HIDES;
+}
 
-        /* Window is 400 x 400. */
-        x = Dy / Dx * 384 + 64; /* basically this should be 100% of x + 50% of y */
-        y = Dz / Dx * 384 + 64; /* basically this should be 100% of x + 50% of y */
+/* Function to plot the part of a line that falls in the tile
+left..right-1, top..bottom-1. Each pixel depends only on its position
+along the line's major axis, so a line split across tiles comes out
+exactly as if drawn in one piece. z0 and z1 are the ends' 1 / distance.
+Given depth cells, the line is walked a cell at a time where there are
+faces: runs behind a face are skipped, runs clear of them drawn, and
+only the rest is depth tested pixel by pixel. */
+void rasterizeLine(int x0, int y0, float z0, int x1, int y1, float z1,
+                   int left, int right, int top, int bottom, DepthCells *d) {
+    int t, lo, hi, i, j, k, next, a0, a1, cover = FACE_NONE;
+    double slope, a, b, swap;
+    float dz, za, zb;
+
+    /* Is pixel i, j at step k along the line in front? */
+#define IN_FRONT(k) (cover == FACE_NONE || z0 + dz * (k) >= \
+        d->cells[(unsigned)(j - top) / DEPTH_CELL * d->cellsX + (unsigned)(i - left) / DEPTH_CELL])
+
+    /* Where is the run of the line from step k to its next cell, or on
+    to the faces if it isn't among them yet? */
+#define NEXT_RUN(k, first, faces0, faces1, end) \
+    next = (k) < (first) + (faces0) * DEPTH_CELL ? (first) + (faces0) * DEPTH_CELL : \
+           (k) >= (first) + ((faces1) + 1) * DEPTH_CELL ? (end) + 1 : \
+           (k) + DEPTH_CELL - ((k) - (first)) % DEPTH_CELL; \
+    if (next > (end) + 1) \
+        next = (end) + 1; \
+    cover = (k) < (first) + (faces0) * DEPTH_CELL || (k) >= (first) + ((faces1) + 1) * DEPTH_CELL ? \
+            FACE_NONE : FACE_SOME
+
+    /* A run crosses at most two cells, cell0 and cell1, on its way from
+    nearest to farthest. */
+#define RUN_COVER(cell0, cell1, nearest, farthest) \
+    cover = (nearest) < (cell0) && (nearest) < (cell1) ? FACE_HIDES : \
+            (farthest) >= (cell0) && (farthest) >= (cell1) ? FACE_NONE : FACE_SOME
+
+    if (abs(x1 - x0) >= abs(y1 - y0)) {
+        if (x0 > x1) {
+            t = x0; x0 = x1; x1 = t;
+            t = y0; y0 = y1; y1 = t;
+            swap = z0; z0 = z1; z1 = swap;
+        }
+        dz = x1 > x0 ? (z1 - z0) / (x1 - x0) : 0;
+        slope = x1 > x0 ? (double)(y1 - y0) / (x1 - x0) : 0;
+        lo = x0 > left ? x0 : left;
+        hi = x1 < right - 1 ? x1 : right - 1;
+        if (slope) {
+            /* Only walk the columns whose row can land in this tile. */
+            a = x0 + (top - 0.5 - y0) / slope;
+            b = x0 + (bottom - 0.5 - y0) / slope;
+            if (a > b) {
+                swap = a; a = b; b = swap;
+            }
+            if (lo < a - 1) lo = a - 1;
+            if (hi > b + 1) hi = b + 1;
+        }
+        for (k = lo; k <= hi; k = next) {
+            next = hi + 1;
+            if (d) {
+                NEXT_RUN(k, left, d->minX, d->maxX, hi);
+                if (cover == FACE_SOME) {
+                    a0 = y0 + (int)floor((k - x0) * slope + 0.5);
+                    a1 = y0 + (int)floor((next - 1 - x0) * slope + 0.5);
+                    if (a0 > a1) {
+                        t = a0; a0 = a1; a1 = t;
+                    }
+                    if (a0 < top) a0 = top;
+                    if (a1 > bottom - 1) a1 = bottom - 1;
+                    if (a0 > a1)
+                        continue;
+                    za = z0 + dz * (k - x0);
+                    zb = z0 + dz * (next - 1 - x0);
+                    RUN_COVER(d->cells[(a0 - top) / DEPTH_CELL * d->cellsX + (k - left) / DEPTH_CELL],
+                              d->cells[(a1 - top) / DEPTH_CELL * d->cellsX + (k - left) / DEPTH_CELL],
+                              za > zb ? za : zb, za < zb ? za : zb);
+                    if (cover == FACE_HIDES)
+                        continue;
+                }
+            }
+            for (i = k; i < next; i++) {
+                j = y0 + (int)floor((i - x0) * slope + 0.5);
+                if (j >= top && j < bottom && IN_FRONT(i - x0))
+                    frameBuffer[j * winWidth + i] = inkPixel;
+            }
+        }
+    } else {
+        if (y0 > y1) {
+            t = x0; x0 = x1; x1 = t;
+            t = y0; y0 = y1; y1 = t;
+            swap = z0; z0 = z1; z1 = swap;
+        }
+        dz = (z1 - z0) / (y1 - y0);
+        slope = (double)(x1 - x0) / (y1 - y0);
+        lo = y0 > top ? y0 : top;
+        hi = y1 < bottom - 1 ? y1 : bottom - 1;
+        for (k = lo; k <= hi; k = next) {
+            next = hi + 1;
+            if (d) {
+                NEXT_RUN(k, top, d->minY, d->maxY, hi);
+                if (cover == FACE_SOME) {
+                    a0 = x0 + (int)floor((k - y0) * slope + 0.5);
+                    a1 = x0 + (int)floor((next - 1 - y0) * slope + 0.5);
+                    if (a0 > a1) {
+                        t = a0; a0 = a1; a1 = t;
+                    }
+                    if (a0 < left) a0 = left;
+                    if (a1 > right - 1) a1 = right - 1;
+                    if (a0 > a1)
+                        continue;
+                    za = z0 + dz * (k - y0);
+                    zb = z0 + dz * (next - 1 - y0);
+                    RUN_COVER(d->cells[(k - top) / DEPTH_CELL * d->cellsX + (a0 - left) / DEPTH_CELL],
+                              d->cells[(k - top) / DEPTH_CELL * d->cellsX + (a1 - left) / DEPTH_CELL],
+                              za > zb ? za : zb, za < zb ? za : zb);
+                    if (cover == FACE_HIDES)
+                        continue;
+                }
+            }
+            for (j = k; j < next; j++) {
+                i = x0 + (int)floor((j - y0) * slope + 0.5);
+                if (i >= left && i < right && IN_FRONT(j - y0))
+                    frameBuffer[j * winWidth + i] = inkPixel;
+            }
+        }
     }
+#undef RUN_COVER
+#undef NEXT_RUN
+#undef IN_FRONT
+}
 
-    /* Function to draw line from previous point to current point */
-    void drawLine(Display *disp, Window win, GC gc) {
-        /* 1E4 flag prevents drawing first point since we don’t have a line
-        until 2nd point is read. It also skips points that fall out of
-        range of view. */
+/* Function to put a face into a tile's depth cells. A cell takes the
+face only if the face covers all of it, and then the face's farthest
+depth over the cell, so a cell never hides anything the face doesn't.
+The face is convex, so it covers a band of cells between the sides'
+furthest cuts into the band. */
+void fillFaceCells(FaceList *l, FaceRef *f, DepthCells *d) {
+    FaceEdge *e, *edges = l->edges + f->firstEdge;
+    int cx, cy, last, y0, y1;
+    double lo, hi, x;
+    float z, dz, *row, *cell;
+
+    /* Only cells inside the face's box can be covered. */
+    cy = f->bounds->minY > d->top ? (f->bounds->minY - d->top + DEPTH_CELL - 1) / DEPTH_CELL : 0;
+    for (; d->top + cy * DEPTH_CELL < d->bottom; cy++) {
+        y0 = d->top + cy * DEPTH_CELL;
+        y1 = y0 + DEPTH_CELL - 1 < d->bottom - 1 ? y0 + DEPTH_CELL - 1 : d->bottom - 1;
+        if (y1 > f->bounds->maxY)
+            break;
+
+        lo = d->left;
+        hi = d->right - 1;
+        for (e = edges; e < edges + f->numLeft; e++) {
+            x = e->x + e->step * y0;
+            lo = x > lo ? x : lo;
+        }
+        for (; e < edges + f->numEdges; e++) {
+            x = e->x + e->step * y0;
+            hi = x < hi ? x : hi;
+        }
 
-        if (prevX - 1E4)
-            /* Draw line from (prevX, prevY) to (x, y).
-            Flickers since we’re not using double buffering. */
-            XDrawLine(disp, win, gc, prevX, prevY, x, y);
-        prevX = x;
-        prevY = y;
+        /* The cells wholly between lo and hi. */
+        cx = lo > d->left ? (int)(lo - d->left) / DEPTH_CELL : 0;
+        cx += d->left + cx * DEPTH_CELL < lo;
+        last = (int)(hi + 1 - d->left) / DEPTH_CELL - 1;
+        if (hi >= d->right - 1)
+            last = d->cellsX - 1;
+        if (cx > last)
+            continue;
+        if (cx < d->minX) d->minX = cx;
+        if (last > d->maxX) d->maxX = last;
+        if (cy < d->minY) d->minY = cy;
+        if (cy > d->maxY) d->maxY = cy;
+
+        /* The plane is farthest at one corner of each cell. */
+        z = (f->planeX * (d->left + cx * DEPTH_CELL + (f->planeX > 0 ? 0 : DEPTH_CELL - 1)) +
+             f->planeY * (f->planeY > 0 ? y0 : y1) + f->planeC) * (1 - DEPTH_BIAS);
+        dz = f->planeX * DEPTH_CELL * (1 - DEPTH_BIAS);
+        if (z > d->rowMax[cy]) d->rowMax[cy] = z;
+        row = d->cells + cy * d->cellsX;
+        for (cell = row + cx; cell <= row + last; cell++, z += dz)
+            if (z > *cell)
+                *cell = z;
+
+        /* z has gone one cell past the row, so it is at least the last one. */
+        if (z > d->rowMax[cy]) d->rowMax[cy] = z;
     }
+}
 
-    void drawHUD(Display *disp, Window win, GC gc) {
-        XDrawString(disp, win, gc, 20, 380, infoStr, 17);
+/* Function to draw the lines between points from..to-1 of a chunk that
+cross a tile of view n. Given depth cells, a line wholly behind faces is
+skipped and one clear of them is drawn without depth tests. */
+void rasterizeLines(SceneChunk *c, int n, int from, int to, int left, int right, int top, int bottom,
+                    DepthCells *d) {
+    int i, x0, y0, x1, y1, cover,
+        *screenX = c->screenX + n * c->num_pts, *screenY = c->screenY + n * c->num_pts;
+    float z0, z1, *invDepth = c->invDepth + n * c->num_pts;
+
+    /* A line runs from each drawable vertex to the next one. */
+    for (i = from + 1; i < to; i++) {
+        if (screenX[i - 1] == NOT_DRAWN || screenX[i] == NOT_DRAWN)
+            continue;
+        x0 = screenX[i - 1]; y0 = screenY[i - 1];
+        x1 = screenX[i]; y1 = screenY[i];
+        if ((y0 < top && y1 < top) || (y0 >= bottom && y1 >= bottom) ||
+            (x0 < left && x1 < left) || (x0 >= right && x1 >= right))
+            continue;
+        z0 = invDepth[i - 1];
+        z1 = invDepth[i];
+        cover = d ? cellsCover(d, ((x0 < x1 ? x0 : x1) > left ? (x0 < x1 ? x0 : x1) - left : 0) / DEPTH_CELL,
+                               ((y0 < y1 ? y0 : y1) > top ? (y0 < y1 ? y0 : y1) - top : 0) / DEPTH_CELL,
+                               ((x0 > x1 ? x0 : x1) < right ? (x0 > x1 ? x0 : x1) - left : right - 1 - left) / DEPTH_CELL,
+                               ((y0 > y1 ? y0 : y1) < bottom ? (y0 > y1 ? y0 : y1) - top : bottom - 1 - top) / DEPTH_CELL,
+                               z0 > z1 ? z0 : z1, z0 < z1 ? z0 : z1) : FACE_NONE;
+        if (cover != FACE_HIDES)
+            rasterizeLine(x0, y0, z0, x1, y1, z1, left, right, top, bottom, cover == FACE_SOME ? d : 0);
     }
+}
 
-    clearWindow(disp, win);
-    
-    /*Loop over points and draw lines.*/
-    for (idx = 0, prevX = 1E4; idx < num_pts;) {
-        /*The world point must be moved so the airplane is the 0,0,0 origin.
-        Then the point must be rotated by all 3 angles.
-        
-        Finally the 3D point must be projected onto the 2D plane of the
-        display. All this is the camera transform in
+/* Function to clear one tile of view n and draw every line that
+crosses it. In hidden-line mode the faces on the tile go into its depth
+cells first; then objects wholly behind them are skipped, and the rest
+are depth tested line by line and, where a line is partly behind a
+face, pixel by pixel. cells is the calling thread's scratch, kept all 0
+between tiles. */
+void rasterizeTile(int n, int top, int bottom, float **cells, int *cellsSize) {
+    int i, y, o, t, cover, numCells;
+    ObjectBounds *b;
+    SceneChunk *c;
+    SceneFile *f;
+    FaceRef *face;
+    DepthCells depth, *d = 0;
+
+    depth.left = views[n].left;
+    depth.right = views[n].left + views[n].width;
+    depth.top = top;
+    depth.bottom = bottom;
+    for (y = top; y < bottom; y++)
+        for (i = y * winWidth + depth.left; i < y * winWidth + depth.right; i++)
+            frameBuffer[i] = paperPixel;
+
+    depth.cellsX = (views[n].width + DEPTH_CELL - 1) / DEPTH_CELL;
+    numCells = depth.cellsX * ((TILE_ROWS + DEPTH_CELL - 1) / DEPTH_CELL);
+    if (hiddenLines && views[n].kind != MAP_VIEW && *cellsSize < numCells) {
+        free(*cells);
+        *cells = calloc(numCells, sizeof **cells);
+        *cellsSize = *cells ? numCells : 0;
+    }
+    depth.cells = *cells;
+    depth.minX = depth.minY = numCells;
+    depth.maxX = depth.maxY = -1;
+    for (y = 0; y < (TILE_ROWS + DEPTH_CELL - 1) / DEPTH_CELL; y++)
+        depth.rowMax[y] = 0;
+    if (hiddenLines && views[n].kind != MAP_VIEW && *cells) {
+        for (t = 0; t < numThreads; t++) {
+            for (face = faceLists[t][n].faces; face < faceLists[t][n].faces + faceLists[t][n].count; face++) {
+                b = face->bounds;
+                if (b->maxY >= top && b->minY < bottom && b->maxX >= depth.left && b->minX < depth.right)
+                    fillFaceCells(&faceLists[t][n], face, &depth);
+            }
+        }
+        if (depth.maxX >= 0)
+            d = &depth;
+    }
 
-        en.wikipedia.org/wiki/Perspective_transform#Perspective_projection.*/
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+        c = f->chunk;
+        for (o = 0; o < c->num_objects; o++) {
+            b = &c->bounds[n * c->num_objects + o];
+            if (c->objects[o].face ||
+                b->maxY < top || b->minY >= bottom || b->maxX < depth.left || b->minX >= depth.right)
+                continue;
+            cover = d ? cellsCover(d, b->minX > depth.left ? (b->minX - depth.left) / DEPTH_CELL : 0,
+                                   b->minY > top ? (b->minY - top) / DEPTH_CELL : 0,
+                                   (b->maxX < depth.right ? b->maxX - depth.left : depth.right - 1 - depth.left) / DEPTH_CELL,
+                                   (b->maxY < bottom ? b->maxY - top : bottom - 1 - top) / DEPTH_CELL,
+                                   b->nearest, b->farthest) : FACE_NONE;
+            if (cover == FACE_HIDES)
+                continue;
+            rasterizeLines(c, n, c->objects[o].start, c->objects[o].end, depth.left, depth.right, top, bottom,
+                           cover == FACE_SOME ? d : 0);
+        }
+    }
 
-        /*Shift world object vertex x,y,z relative to airplane as origin.
-        The Z line uses + because airplaneZ is upward positive. It has to
-        be negated because world Z is upward negative:
-        worldZ – -airplaneZ = worldZ + airplaneZ. */
+    /* Leave the cells all 0 for the next tile. */
+    if (d)
+        for (y = d->minY; y <= d->maxY; y++)
+            for (i = d->minX; i <= d->maxX; i++)
+                d->cells[y * d->cellsX + i] = 0;
+}
+
+/* Function to do one thread's share of a frame. Thread n projects the
+n-th slice of each file's vertices into every view, then bounds the n-th
+slice of its objects. Once every object is bounded, the tiles of all the
+views are dealt out in turn, so the views are drawn side by side on
+different threads. */
+void renderShare(int n) {
+    static float *cells[MAX_THREADS];
+    static int cellsSize[MAX_THREADS];
+    int idx, tile = 0, top, bottom, v;
+    SceneChunk *c;
+    SceneFile *f;
+
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+        c = f->chunk;
+        for (idx = c->num_pts * n / numThreads; idx < c->num_pts * (n + 1) / numThreads; idx++)
+            projectVertex(c, idx);
+    }
 
-        shiftWorldObjectVertex(idx);
-        applyRotationMatrix();
+    frameBarrierWait(&frameProjected);
 
-        /*0,0,0 signals end of an object. Dy or Dz larger than Dx means point
-        is out of range of view (assuming a square display). */
+    for (v = 0; v < num_views; v++)
+        faceLists[n][v].count = faceLists[n][v].numEdges = 0;
+    for (f = sceneFiles; f < sceneFiles + num_scene_files; f++) {
+        c = f->chunk;
+        boundObjects(c, c->num_objects * n / numThreads, c->num_objects * (n + 1) / numThreads, n);
+    }
 
-        if (worldX[idx] + worldY[idx] + worldZ[idx] == 0 || Dx < fabs(Dy) || Dx < fabs(Dz)) {
-            /* Don’t draw this point and set flag to not draw it next time
-            through loop. */
-            prevX = 1e4;
-        } else {
+    frameBarrierWait(&frameBounded);
 
+    for (v = 0; v < num_views; v++) {
+        bottom = views[v].top + views[v].height;
+        for (top = views[v].top; top < bottom; top += TILE_ROWS, tile++)
+            if (tile % numThreads == n)
+                rasterizeTile(v, top, top + TILE_ROWS < bottom ? top + TILE_ROWS : bottom,
+                              &cells[n], &cellsSize[n]);
+    }
+}
 
-            project3DPointOnto2DPlane();
-            drawLine(disp, win, gc);
-        }
+/* Function run by each extra rasterizer thread, one frame per lap */
+void *renderWorker(void *arg) {
+    for (;;) {
+        frameBarrierWait(&frameStart);
+        renderShare((int)(long)arg);
+        frameBarrierWait(&frameDone);
+    }
+    return 0;
+}
+
+/* Function to start the rasterizer threads. The main thread is worker 0. */
+void startRenderWorkers() {
+    long n;
+
+    if (numThreads < 1)
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads < 1)
+        numThreads = 1;
+    if (numThreads > MAX_THREADS)
+        numThreads = MAX_THREADS;
+
+    frameBarrierInit(&frameStart, numThreads);
+    frameBarrierInit(&frameProjected, numThreads);
+    frameBarrierInit(&frameBounded, numThreads);
+    frameBarrierInit(&frameDone, numThreads);
+    for (n = 1; n < numThreads; n++)
+        pthread_create(&workers[n], 0, renderWorker, (void *)n);
+}
+
+/* Function to update the display */
+void updateDisplay(Display *disp, Window win, GC gc) {
+
+    void drawHUD(Display *disp, Window win, GC gc) {
+        XDrawString(disp, win, gc, views[0].left + 20, views[0].top + views[0].height - 12, infoStr, 17);
+    }
 
-        ++idx;
+    /* Frame each view and name it. The map marks the airplane with an
+    arrow along its heading, since it is too small to see there. */
+    void drawViewFrames(Display *disp, Window win, GC gc) {
+        View *view;
+        int cx, cy, nx, ny;
+
+        for (view = views; view < views + num_views; view++) {
+            XDrawRectangle(disp, win, gc, view->left, view->top, view->width - 1, view->height - 1);
+            XDrawString(disp, win, gc, view->left + 6, view->top + 14, viewNames[view->kind], strlen(viewNames[view->kind]));
+            if (view->kind != MAP_VIEW)
+                continue;
+            cx = view->left + view->width / 2;
+            cy = view->top + view->height / 2;
+            nx = 8 * sin(compassRadians);
+            ny = -8 * cos(compassRadians);
+            XDrawLine(disp, win, gc, cx - nx, cy - ny, cx + nx, cy + ny);
+            XDrawLine(disp, win, gc, cx + nx, cy + ny, cx - ny / 2, cy + nx / 2);
+            XDrawLine(disp, win, gc, cx + nx, cy + ny, cx + ny / 2, cy - nx / 2);
+        }
     }
-    
+
+    /* All threads project and rasterize the frame off-screen. The window
+    size and the scenery only change between frames. */
+    swapInReloadedScenes();
+    aimViews();
+    if (useShm)
+        XSync(disp, False); /* The server is done reading the last frame. */
+    frameBarrierWait(&frameStart);
+    renderShare(0);
+    frameBarrierWait(&frameDone);
+
+    if (useShm)
+        XShmPutImage(disp, win, gc, frameImage, 0, 0, 0, 0, winWidth, winHeight, False);
+    else
+        XPutImage(disp, win, gc, frameImage, 0, 0, 0, 0, winWidth, winHeight);
+    if (num_views > 1)
+        drawViewFrames(disp, win, gc);
+
     /*HUD. infoStr = 3 values: speed in knots, heading 0=N 90=E 180=S 270=W,
     altimeter in feet.*/
     drawHUD(disp, win, gc);
@@ -406,6 +1546,13 @@ void handleKeyPress(Display *disp) {
     while (XPending(disp)) {
         /*Get key press.*/
         XNextEvent(disp, &event);
+        if (event.type == ConfigureNotify) {
+            if (event.xconfigure.width != winWidth || event.xconfigure.height != winHeight)
+                resizeViewport(disp, event.xconfigure.width, event.xconfigure.height);
+            continue;
+        }
+        if (event.type != KeyPress)
+            continue;
         KeySym key = XLookupKeysym(&event.xkey, 0);
         switch (key) {
             case Up:
@@ -512,24 +1659,496 @@ void updatePhysics() {
     updateV();
 }
 
+/* AI traffic.
+
+Other aircraft fly the same Cherokee equations as calculateAngles() and
+updatePhysics(), with an autopilot on the stick. Their state is kept
+structure-of-arrays in groups of LANES aircraft, and each group is
+stepped with GCC vector arithmetic, so one instruction advances several
+aircraft at once. The sines and cosines go lane by lane, and so does the
+autopilot: flyAutopilot() runs scalar, one aircraft at a time, with its
+atan2 and branches.
+
+Each aircraft is drawn as a small wireframe through the traffic chunk,
+which is rebuilt in place every tick, between frames, and rendered like
+any scene file. Each model is an object of its own, so tiles skip the
+aircraft they can't see. */
+
+#define LANES 4
+#define MODEL_PTS 10 /* Points per aircraft in the traffic chunk. */
+
+typedef double Lanes __attribute__ ((vector_size (LANES * sizeof(double))));
+
+/* Wireframe in body axes, feet: x forward, y right wing, z down. Drawn a
+few times life size so it shows at a distance. 0 0 0 ends a line. */
+double trafficModel[MODEL_PTS][3] = {
+    {36, 0, 0}, {-36, 0, 0}, {-36, 0, -18}, {0, 0, 0},  /* Fuselage, fin. */
+    {6, -45, 0}, {6, 45, 0}, {0, 0, 0},                 /* Wing. */
+    {-33, -15, 0}, {-33, 15, 0}, {0, 0, 0}              /* Tailplane. */
+};
+
+enum { CIRCLE, WAYPOINTS }; /* Autopilot profiles. */
+
+#define NUM_WAYPOINTS 4
+
+typedef struct {
+    int count, groups;          /* Aircraft, and groups of LANES of them. */
+
+    /* Flight model state, same names as the player's globals. */
+    Lanes *airplaneX, *airplaneY, *airplaneZ,
+          *compassRadians, *forwardTiltRadians, *sideTiltRadians,
+          *F, *P, *v, *d, *M, *X, *H, *speedFeet;
+    Lanes *up_down, *left_right, *speed; /* Controls. */
+
+    /* Autopilot, one per aircraft. */
+    int *profile, *waypoint;
+    double *holdAltitude, *bank, *trim;
+    double (*waypointXY)[NUM_WAYPOINTS][2];
+} Traffic;
+
+Traffic traffic;
+SceneChunk *trafficChunk;
+int trafficCount;
+
+/* Function to allocate n groups of lanes, zeroed */
+Lanes *allocLanes(int n) {
+    void *p;
+
+    if (posix_memalign(&p, sizeof(Lanes), n * sizeof(Lanes))) {
+        fprintf(stderr, "banks: out of memory for traffic\n");
+        exit(1);
+    }
+    return memset(p, 0, n * sizeof(Lanes));
+}
+
+double trafficRandom(double lo, double hi) {
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+/* Function to make each of the count models in a chunk an object */
+int modelObjects(SceneChunk *c, int count) {
+    int i;
+
+    c->objects = calloc(count, sizeof *c->objects);
+    c->bounds = malloc((size_t)num_views * count * sizeof *c->bounds);
+    if (!c->objects || !c->bounds)
+        return 0;
+    for (i = 0; i < count; i++) {
+        c->objects[i].start = i * MODEL_PTS;
+        c->objects[i].end = (i + 1) * MODEL_PTS - 1; /* Less the last 0 0 0. */
+    }
+    c->num_objects = count;
+    return 1;
+}
+
+/* Function to spawn count aircraft around the start point and register
+their chunk with the scenery */
+void setupTraffic(int count) {
+    int g, i, w;
+    SceneFile *f;
+
+    if (count <= 0)
+        return;
+    if (num_scene_files == MAX_SCENE_FILES) {
+        fprintf(stderr, "banks: too many scene files for traffic\n");
+        return;
+    }
+
+    traffic.count = count;
+    traffic.groups = g = (count + LANES - 1) / LANES;
+    traffic.airplaneX = allocLanes(g);
+    traffic.airplaneY = allocLanes(g);
+    traffic.airplaneZ = allocLanes(g);
+    traffic.compassRadians = allocLanes(g);
+    traffic.forwardTiltRadians = allocLanes(g);
+    traffic.sideTiltRadians = allocLanes(g);
+    traffic.F = allocLanes(g);
+    traffic.P = allocLanes(g);
+    traffic.v = allocLanes(g);
+    traffic.d = allocLanes(g);
+    traffic.M = allocLanes(g);
+    traffic.X = allocLanes(g);
+    traffic.H = allocLanes(g);
+    traffic.speedFeet = allocLanes(g);
+    traffic.up_down = allocLanes(g);
+    traffic.left_right = allocLanes(g);
+    traffic.speed = allocLanes(g);
+
+    g *= LANES; /* Spare lanes in the last group fly too, unseen. */
+    traffic.profile = calloc(g, sizeof(int));
+    traffic.waypoint = calloc(g, sizeof(int));
+    traffic.holdAltitude = calloc(g, sizeof(double));
+    traffic.bank = calloc(g, sizeof(double));
+    traffic.trim = calloc(g, sizeof(double));
+    traffic.waypointXY = calloc(g, sizeof *traffic.waypointXY);
+
+    /* Same trimmed start as the player, scattered over the scenery. */
+    srand(1998);
+    for (i = 0; i < g; i++) {
+        traffic.airplaneX[i / LANES][i % LANES] = trafficRandom(-20000, 20000);
+        traffic.airplaneY[i / LANES][i % LANES] = trafficRandom(-20000, 20000);
+        traffic.airplaneZ[i / LANES][i % LANES] = traffic.holdAltitude[i] = trafficRandom(600, 3000);
+        traffic.compassRadians[i / LANES][i % LANES] = trafficRandom(0, 6.28);
+        traffic.forwardTiltRadians[i / LANES][i % LANES] = 33e-3;
+        traffic.speedFeet[i / LANES][i % LANES] = 221;
+        traffic.X[i / LANES][i % LANES] = 7.26;
+        traffic.speed[i / LANES][i % LANES] = 8;
+
+        traffic.profile[i] = i % 2 ? WAYPOINTS : CIRCLE;
+        traffic.bank[i] = trafficRandom(15, 30) / 57.3 * (rand() % 2 ? 1 : -1);
+        for (w = 0; w < NUM_WAYPOINTS; w++) {
+            traffic.waypointXY[i][w][0] = trafficRandom(-20000, 20000);
+            traffic.waypointXY[i][w][1] = trafficRandom(-20000, 20000);
+        }
+    }
+
+    trafficChunk = calloc(1, sizeof *trafficChunk);
+    trafficChunk->num_pts = count * MODEL_PTS;
+    trafficChunk->worldX = calloc(trafficChunk->num_pts, sizeof(double));
+    trafficChunk->worldY = calloc(trafficChunk->num_pts, sizeof(double));
+    trafficChunk->worldZ = calloc(trafficChunk->num_pts, sizeof(double));
+    if (!trafficChunk->worldX || !trafficChunk->worldY || !trafficChunk->worldZ ||
+        !allocScreenPositions(trafficChunk) || !modelObjects(trafficChunk, count)) {
+        fprintf(stderr, "banks: out of memory for traffic\n");
+        exit(1);
+    }
+
+    f = &sceneFiles[num_scene_files++];
+    f->chunk = trafficChunk;
+}
+
+/* Function to give our own airplane a wireframe if a view can see it */
+void setupPlayerModel() {
+    View *view;
+
+    for (view = views; view < views + num_views && view->kind != CHASE_VIEW; view++);
+    if (view == views + num_views || num_scene_files == MAX_SCENE_FILES)
+        return;
+
+    playerChunk = calloc(1, sizeof *playerChunk);
+    playerChunk->num_pts = MODEL_PTS;
+    playerChunk->worldX = calloc(MODEL_PTS, sizeof(double));
+    playerChunk->worldY = calloc(MODEL_PTS, sizeof(double));
+    playerChunk->worldZ = calloc(MODEL_PTS, sizeof(double));
+    if (!playerChunk->worldX || !playerChunk->worldY || !playerChunk->worldZ ||
+        !allocScreenPositions(playerChunk) || !modelObjects(playerChunk, 1)) {
+        fprintf(stderr, "banks: out of memory\n");
+        exit(1);
+    }
+    sceneFiles[num_scene_files++].chunk = playerChunk;
+}
+
+/* Function to move our airplane's wireframe to where we are now, the
+same way stepTraffic() places the others */
+void placePlayerModel() {
+    double *b;
+    int k;
+
+    if (!playerChunk)
+        return;
+    for (k = 0; k < MODEL_PTS; k++) {
+        b = trafficModel[k];
+        if (b[0] + b[1] + b[2] == 0)
+            continue;
+        playerChunk->worldX[k] = airplaneX + R11 * b[0] + R21 * b[1] + R31 * b[2];
+        playerChunk->worldY[k] = airplaneY + R12 * b[0] + R22 * b[1] + R32 * b[2];
+        playerChunk->worldZ[k] = -airplaneZ + R13 * b[0] + R23 * b[1] + R33 * b[2];
+    }
+}
+
+double clampStick(double a) {
+    return a > 3 ? 3 : a < -3 ? -3 : a;
+}
+
+/* Function to set the stick for one aircraft. Bank to the profile's
+roll angle, or to turn toward the next waypoint, with roll-rate damping.
+Hold altitude from the altitude error and climb rate, with a slow trim
+for the steady part. Up and Left on the stick are positive, as on the
+keyboard: Up pushes the nose down, Left rolls left. */
+void flyAutopilot(int i, double roll, double rollRate, double climbRate) {
+    int g = i / LANES, l = i % LANES;
+    double *wp, headingError, rollTarget, altitudeError;
+
+    if (traffic.profile[i] == CIRCLE) {
+        rollTarget = traffic.bank[i];
+    } else {
+        wp = traffic.waypointXY[i][traffic.waypoint[i]];
+        if (fabs(wp[0] - traffic.airplaneX[g][l]) + fabs(wp[1] - traffic.airplaneY[g][l]) < 2000)
+            traffic.waypoint[i] = (traffic.waypoint[i] + 1) % NUM_WAYPOINTS;
+        headingError = atan2(wp[1] - traffic.airplaneY[g][l], wp[0] - traffic.airplaneX[g][l]) -
+                       traffic.compassRadians[g][l];
+        headingError = atan2(sin(headingError), cos(headingError));
+        rollTarget = headingError * 1.5;
+        if (fabs(rollTarget) > 25 / 57.3)
+            rollTarget = rollTarget > 0 ? 25 / 57.3 : -25 / 57.3;
+    }
+    traffic.left_right[g][l] = clampStick(-(0.2 * (rollTarget - roll) - 0.1 * rollRate) * 57.3);
+
+    altitudeError = traffic.airplaneZ[g][l] - traffic.holdAltitude[i];
+    traffic.trim[i] = clampStick(traffic.trim[i] + 0.002 * altitudeError * timeDelta);
+    traffic.up_down[g][l] = clampStick(0.01 * altitudeError + 0.05 * climbRate + traffic.trim[i]);
+}
+
+/* Function to advance every aircraft one tick and redraw their models */
+void stepTraffic() {
+    Lanes cos_forwardTilt, sin_forwardTilt, cos_compass, sin_compass, cos_sideTilt, sin_sideTilt,
+          R11, R12, R13, R21, R22, R23, R31, R32, R33,
+          I, m, E, T, t, accel, a, W, D, climbRate, px, py, pz;
+    Lanes *airplaneX, *airplaneY, *airplaneZ, *compassRadians, *forwardTiltRadians, *sideTiltRadians,
+          *F, *P, *v, *d, *M, *X, *H, *speedFeet, *up_down, *left_right, *speed;
+    double bx, by, bz;
+    int g, l, i, k, n;
+
+    for (g = 0; g < traffic.groups; g++) {
+        airplaneX = traffic.airplaneX + g;
+        airplaneY = traffic.airplaneY + g;
+        airplaneZ = traffic.airplaneZ + g;
+        compassRadians = traffic.compassRadians + g;
+        forwardTiltRadians = traffic.forwardTiltRadians + g;
+        sideTiltRadians = traffic.sideTiltRadians + g;
+        F = traffic.F + g;
+        P = traffic.P + g;
+        v = traffic.v + g;
+        d = traffic.d + g;
+        M = traffic.M + g;
+        X = traffic.X + g;
+        H = traffic.H + g;
+        speedFeet = traffic.speedFeet + g;
+        up_down = traffic.up_down + g;
+        left_right = traffic.left_right + g;
+        speed = traffic.speed + g;
+
+        /* calculateAngles() */
+        for (l = 0; l < LANES; l++) {
+            cos_forwardTilt[l] = cos((*forwardTiltRadians)[l]);
+            sin_forwardTilt[l] = sin((*forwardTiltRadians)[l]);
+            cos_compass[l] = cos((*compassRadians)[l]);
+            sin_compass[l] = sin((*compassRadians)[l]);
+            cos_sideTilt[l] = cos((*sideTiltRadians)[l]);
+            sin_sideTilt[l] = sin((*sideTiltRadians)[l]);
+        }
+
+        *F += timeDelta * *P;
+        *compassRadians += cos_sideTilt * timeDelta * *F / cos_forwardTilt + *d / cos_forwardTilt * sin_sideTilt * timeDelta;
+        *forwardTiltRadians += *d * timeDelta * cos_sideTilt - timeDelta * *F * sin_sideTilt;
+        *sideTiltRadians += (sin_sideTilt * *d / cos_forwardTilt * sin_forwardTilt + *v + sin_forwardTilt / cos_forwardTilt * *F * cos_sideTilt) * timeDelta;
+
+        R11 = cos_forwardTilt * cos_compass;
+        R12 = cos_forwardTilt * sin_compass;
+        R13 = -sin_forwardTilt;
+        R21 = cos_compass * sin_sideTilt * sin_forwardTilt - sin_compass * cos_sideTilt;
+        R22 = cos_sideTilt * cos_compass + sin_sideTilt * sin_compass * sin_forwardTilt;
+        R23 = sin_sideTilt * cos_forwardTilt;
+        R31 = sin_compass * sin_sideTilt + cos_sideTilt * sin_forwardTilt * cos_compass;
+        R32 = sin_forwardTilt * sin_compass * cos_sideTilt - sin_sideTilt * cos_compass;
+        R33 = cos_sideTilt * cos_forwardTilt;
+
+        /* The autopilot is where a pilot would press keys. */
+        climbRate = -R13 * *speedFeet - R23 * *M - R33 * *X;
+        for (l = 0; l < LANES; l++)
+            flyAutopilot(g * LANES + l, (*sideTiltRadians)[l], (*v)[l], climbRate[l]);
+
+        /* updatePhysics() */
+        *M += *H * timeDelta;
+        I = *M / *speedFeet;
+        *airplaneX += (R11 * *speedFeet + R21 * *M + R31 * *X) * timeDelta;
+        *airplaneY += (R12 * *speedFeet + I * *M + R32 * *X) * timeDelta;
+        *airplaneZ += (-R13 * *speedFeet - R23 * *M - R33 * *X) * timeDelta;
+        m = 15 * *F / *speedFeet;
+        E = 0.1 + *X * 4.9 / *speedFeet;
+        T = *X * *X + *speedFeet * *speedFeet + *M * *M;
+        t = T * m / 32 - I * T / 24;
+        *H = gravityAccel * R23 + *v * *X - *F * *speedFeet + t / S;
+        accel = *F * *M + (*speed * 1e4 / *speedFeet - (T + E * 5 * T * E) / 3e2) / S - *X * *d - sin_forwardTilt * gravityAccel;
+        *speedFeet += accel * timeDelta;
+        a = 2.63 / *speedFeet * *d;
+        *X += (*d * *speedFeet - T / S * (0.19 * E + a * 0.64 + *up_down / 1e3) - *M * *v + gravityAccel * R33) * timeDelta;
+        W = *d;
+        *d += T * (0.45 - 14 / *speedFeet * *X - a * 130 - *up_down * 0.14) * timeDelta / 125e2 + *F * timeDelta * *v;
+        D = *v / *speedFeet * 15;
+        *P = (T * (47 * I - m * 52 + E * 94 * D - t * 0.38 + *left_right * 0.21 * E) / 1e2 + W * 179 * *v) / 2312;
+        *v -= (W * *F - T * (0.63 * m - I * 0.086 + m * E * 19 - D * 25 - 0.11 * *left_right) / 107e2) * timeDelta;
+
+        /* Model to world: the transpose of R turns body axes into world
+        axes. World Z is negative upward. */
+        for (k = 0; k < MODEL_PTS; k++) {
+            bx = trafficModel[k][0];
+            by = trafficModel[k][1];
+            bz = trafficModel[k][2];
+            if (bx + by + bz == 0)
+                continue; /* Breaks stay 0 0 0. */
+            px = *airplaneX + R11 * bx + R21 * by + R31 * bz;
+            py = *airplaneY + R12 * bx + R22 * by + R32 * bz;
+            pz = -*airplaneZ + R13 * bx + R23 * by + R33 * bz;
+            for (l = 0; l < LANES; l++) {
+                i = g * LANES + l;
+                if (i >= traffic.count)
+                    break;
+                n = i * MODEL_PTS + k;
+                trafficChunk->worldX[n] = px[l];
+                trafficChunk->worldY[n] = py[l];
+                trafficChunk->worldZ[n] = pz[l];
+            }
+        }
+    }
+}
+
+/* Function to create the shared memory page for telemetry. The sim
+flies on without it if that fails. */
+void setupTelemetry() {
+    int fd = shm_open(TELEMETRY_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    struct stat st;
+    void *page;
+
+    /* Only size a new page. macOS refuses to resize a shm object that
+    already has a size, so a page left by an earlier run is reused. */
+    if (fd < 0 || fstat(fd, &st) < 0 ||
+        (st.st_size < (off_t)sizeof *telemetry && ftruncate(fd, sizeof *telemetry) < 0)) {
+        perror("banks: telemetry " TELEMETRY_SHM_NAME);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    page = mmap(0, sizeof *telemetry, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("banks: telemetry mmap");
+        return;
+    }
+
+    /* A reader may still be attached to a page left by an earlier run. */
+    telemetry = page;
+    __atomic_store_n(&telemetry->magic, 0, __ATOMIC_RELEASE);
+    telemetry->version = TELEMETRY_VERSION;
+    telemetry->size = sizeof telemetry->state;
+    if (telemetry->seq & 1)
+        telemetry->seq++;
+    __atomic_store_n(&telemetry->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Function to publish this tick's flight state */
+void publishTelemetry() {
+    struct timespec now;
+
+    if (!telemetry)
+        return;
+
+    telemetryState.tick++;
+    telemetryState.simSeconds = telemetryState.tick * dt;
+    telemetryState.x = airplaneX;
+    telemetryState.y = airplaneY;
+    telemetryState.altitude = airplaneZ;
+    telemetryState.heading = compassRadians;
+    telemetryState.pitch = forwardTiltRadians;
+    telemetryState.roll = sideTiltRadians;
+    telemetryState.rotation[0][0] = R11;
+    telemetryState.rotation[0][1] = R12;
+    telemetryState.rotation[0][2] = R13;
+    telemetryState.rotation[1][0] = R21;
+    telemetryState.rotation[1][1] = R22;
+    telemetryState.rotation[1][2] = R23;
+    telemetryState.rotation[2][0] = R31;
+    telemetryState.rotation[2][1] = R32;
+    telemetryState.rotation[2][2] = R33;
+    telemetryState.speedFeet = speedFeet;
+    telemetryState.speedKnots = speedKnots;
+    telemetryState.throttle = speed;
+    telemetryState.stickUpDown = up_down;
+    telemetryState.stickLeftRight = left_right;
+
+    /* Stamped last so readers measure only the hand-off. */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    telemetryState.monoNanos = now.tv_sec * (int64_t)1000000000 + now.tv_nsec;
+
+    telemetryWrite(telemetry, &telemetryState);
+}
+
+/* Function to read the command line options */
+void parseOptions(int argc, char **argv) {
+    int opt, kind;
+    char *name;
+
+    while ((opt = getopt(argc, argv, "g:f:a:j:n:v:m:H")) != -1) {
+        switch (opt) {
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &winWidth, &winHeight) != 2 || winWidth < 1 || winHeight < 1)
+                    goto usage;
+                break;
+            case 'f':
+                fovDegrees = atof(optarg);
+                if (fovDegrees <= 0 || fovDegrees >= 180)
+                    goto usage;
+                break;
+            case 'a':
+                pixelAspect = atof(optarg);
+                if (pixelAspect <= 0)
+                    goto usage;
+                break;
+            case 'j':
+                numThreads = atoi(optarg);
+                break;
+            case 'n':
+                trafficCount = atoi(optarg);
+                break;
+            case 'v':
+                num_views = 0;
+                for (name = strtok(optarg, ","); name; name = strtok(0, ",")) {
+                    for (kind = MAP_VIEW; kind >= 0 && strcmp(name, viewNames[kind]); kind--);
+                    if (kind < 0 || num_views == MAX_VIEWS)
+                        goto usage;
+                    views[num_views++].kind = kind;
+                }
+                if (!num_views)
+                    goto usage;
+                break;
+            case 'H':
+                hiddenLines = 1;
+                break;
+            case 'm':
+                mapFeet = atof(optarg);
+                if (mapFeet <= 0)
+                    goto usage;
+                break;
+            default:
+                goto usage;
+        }
+    }
+    return;
+
+usage:
+    fprintf(stderr, "usage: %s [-g WxH] [-f fov_degrees] [-a pixel_aspect] [-j threads] [-n aircraft] [-v view,...] [-m map_feet] [-H] [file.scene ... | < scene]\n", argv[0]);
+    exit(2);
+}
+
 /* Main function */
-main() {
+main(int argc, char **argv) {
     Display *disp;
     Window win;
     GC gc;
 
+    parseOptions(argc, argv);
+
     /* Set up X Windows */
     setupXWindows(&disp, &win, &gc);
 
-    /* Load map files from stdin */
-    loadMapFiles();
+    /* Load map files named after the options, or from stdin */
+    loadMapFiles(argc - optind, argv + optind);
+    setupTraffic(trafficCount);
+    setupPlayerModel();
+
+    startRenderWorkers();
+    startSceneWatcher();
+    setupTelemetry();
 
     /* Infinite loop to update the simulation */
     for (;;) {
         sleepForInterval();
         calculateAngles();
+        placePlayerModel();
         updateDisplay(disp, win, gc);
         handleKeyPress(disp);
         updatePhysics();
+        stepTraffic();
+        publishTelemetry();
     }
 }
\ No newline at end of file
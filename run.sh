@@ -1,2 +1,2 @@
 #! /bin/sh
-cat horizon.scene pittsburgh.scene | ./banks
\ No newline at end of file
+./banks horizon.scene pittsburgh.scene
@@ -0,0 +1,639 @@
+/* Offline scene optimizer for banks.
+
+Reads .scene data the way banks does (lists of 3d points, each list drawn
+connect-a-dot and ended by a point whose coordinates sum to 0, normally
+0 0 0) and writes an equivalent scene that draws the same lines with
+fewer points:
+
+1. Weld: points at the same place become one vertex, optionally after
+   snapping to a grid so near misses meet.
+2. Drop degenerate data: zero-length segments, segments drawn twice
+   (either direction, any object) and lists with no segment at all.
+3. Stitch: the remaining segments are walked into the longest polylines
+   we can find, going straight on where a vertex has a choice, so every
+   0 0 0 stroke break that isn't needed goes away.
+4. Drop collinear points: a point is left out when it lies on the line
+   between its neighbours, if -l allows the longer segment that makes.
+
+Faces (lists ended by 1 -1 0, see banks.c) are copied through as they
+are. With -f, buildings drawn as wireframe boxes, a convex outline at
+ground and roof height joined by upright edges, get faces too: a wall
+for each side and a roof, so banks -H can hide what is behind them.
+Faces draw nothing, so the buildings' lines are all kept as they were.
+
+banks culls per point, so a line is only drawn while both its ends are
+in view. A merged segment vanishes as soon as either of its far ends
+leaves the view, where the pieces it replaced would still partly show.
+So by default no merged segment is longer than the longest piece it
+replaces, and the image stays exactly the same. In practice that keeps
+every point; -l trades that for fewer points.
+
+Compile:
+
+gcc -ansi sceneopt.c -lm -o sceneopt
+
+Run:
+
+./sceneopt pittsburgh.scene > pittsburgh.opt.scene
+cat horizon.scene pittsburgh.scene | ./sceneopt > world.scene
+
+Files are read in order as if cat-ed together, stdin if none are given.
+Before and after counts go to stderr.
+
+Options:
+
+-w ft   weld grid; snap points to multiples of this first (default 0, exact)
+-e ft   how far a dropped point may be off the line (default 0.5)
+-l ft   longest segment made by dropping points, 0 = no limit (default: no
+        longer than the longest piece it replaces)
+-f      add faces to wireframe buildings
+
+*/
+
+#define _XOPEN_SOURCE 600 /* getopt under -ansi */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/* A welded vertex. */
+typedef struct {
+    double x, y, z;
+} Vertex;
+
+/* An input point before welding, remembering where it came from. */
+typedef struct {
+    Vertex v;
+    int order;
+} Point;
+
+/* An undirected segment between two welded vertices, a < b. */
+typedef struct {
+    int a, b;
+} Edge;
+
+#define MAX_CORNERS 64 /* Most corners a building outline may have. */
+
+double weldGrid = 0, collinearEps = 0.5,
+       maxLength = -1; /* Below 0: the longest piece being merged. */
+int makeFaces;
+
+Point *points;      /* Every input point, in file order. */
+int num_points, num_breaks;
+
+Vertex *vertices;   /* Welded vertices. */
+int *vertexOf;      /* Input point -> welded vertex, -1 for a break. */
+int num_vertices;
+
+char *covered;      /* Point belongs to a face, not a line. */
+int num_faces, num_face_points;
+
+Edge *edges;
+int num_edges, num_input_segments, num_input_lists;
+
+int *adjStart, *adjEdge; /* Edges at each vertex, CSR style. */
+char *edgeUsed;
+
+int *paths, *pathStart, num_paths; /* Stitched polylines, end to end. */
+int *loop;               /* Loop being walked for splicing. */
+int *chain, chainLen;    /* Polyline being written. */
+int num_out_points, num_out_segments, num_out_lists;
+
+/* Function to grow an array to hold at least n items */
+void *grow(void *p, int n, int *cap, size_t size) {
+    if (n < *cap)
+        return p;
+    *cap = *cap ? *cap * 2 : 1024;
+    p = realloc(p, *cap * size);
+    if (!p) {
+        fprintf(stderr, "sceneopt: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* Function to append one file's points */
+void readScene(FILE *f) {
+    static int cap;
+    Vertex v;
+
+    while (fscanf(f, "%lf%lf%lf", &v.x, &v.y, &v.z) == 3) {
+        points = grow(points, num_points, &cap, sizeof *points);
+        points[num_points].v = v;
+        points[num_points].order = num_points;
+        num_points++;
+    }
+}
+
+/* banks treats any point whose coordinates sum to 0 as end-of-object. */
+int isBreak(Vertex *v) {
+    return v->x + v->y + v->z == 0;
+}
+
+double snap(double c) {
+    return weldGrid > 0 ? floor(c / weldGrid + 0.5) * weldGrid : c;
+}
+
+int compareVertex(const void *pa, const void *pb) {
+    const Vertex *a = pa, *b = pb;
+
+    if (a->x != b->x) return a->x < b->x ? -1 : 1;
+    if (a->y != b->y) return a->y < b->y ? -1 : 1;
+    if (a->z != b->z) return a->z < b->z ? -1 : 1;
+    return 0;
+}
+
+int comparePoint(const void *pa, const void *pb) {
+    int c = compareVertex(&((const Point *)pa)->v, &((const Point *)pb)->v);
+
+    return c ? c : ((const Point *)pa)->order - ((const Point *)pb)->order;
+}
+
+int compareEdge(const void *pa, const void *pb) {
+    const Edge *a = pa, *b = pb;
+
+    return a->a != b->a ? a->a - b->a : a->b - b->b;
+}
+
+/* Function to weld equal points into shared vertices */
+void weldVertices() {
+    Point *sorted = malloc((num_points + 1) * sizeof *sorted);
+    int i;
+
+    vertices = malloc((num_points + 1) * sizeof *vertices);
+    vertexOf = malloc((num_points + 1) * sizeof *vertexOf);
+
+    for (i = 0; i < num_points; i++) {
+        sorted[i] = points[i];
+        if (isBreak(&sorted[i].v))
+            continue;
+        sorted[i].v.x = snap(sorted[i].v.x);
+        sorted[i].v.y = snap(sorted[i].v.y);
+        sorted[i].v.z = snap(sorted[i].v.z);
+    }
+    qsort(sorted, num_points, sizeof *sorted, comparePoint);
+
+    for (i = 0; i < num_points; i++) {
+        /* Snapping may move a point onto the sum-zero plane; leave it out
+        rather than turn it into a break. */
+        if (isBreak(&sorted[i].v)) {
+            vertexOf[sorted[i].order] = -1;
+            continue;
+        }
+        if (!num_vertices || compareVertex(&vertices[num_vertices - 1], &sorted[i].v))
+            vertices[num_vertices++] = sorted[i].v;
+        vertexOf[sorted[i].order] = num_vertices - 1;
+    }
+    free(sorted);
+}
+
+void printVertex(Vertex *v) {
+    printf("%.15g %.15g %.15g\n", v->x, v->y, v->z);
+}
+
+void writeVertex(Vertex *v) {
+    printVertex(v);
+    num_out_points++;
+}
+
+/* Function to check that input points start..end-1, ended at end, are
+a face: closed, and tagged 1 -1 0 */
+int isFace(int start, int end) {
+    Vertex *tag = &points[end].v;
+
+    return end < num_points && tag->x == 1 && tag->y == -1 && tag->z == 0 &&
+           end - start >= 4 && !compareVertex(&points[start].v, &points[end - 1].v);
+}
+
+/* Function to write welded vertices as one face. Faces draw nothing,
+so they are counted apart from the lines. */
+void writeFace(int *v, int n) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        printVertex(&vertices[v[i]]);
+    printVertex(&vertices[v[0]]);
+    printf("1 -1 0\n");
+    num_face_points += n + 2;
+    num_faces++;
+}
+
+/* Function to find the list at input points start..end-1 in a vertex of
+its own */
+int findInList(int start, int end, double x, double y, double z) {
+    int i;
+    Vertex *v;
+
+    for (i = start; i < end; i++) {
+        v = &vertices[vertexOf[i]];
+        if (v->x == x && v->y == y && v->z == z)
+            return vertexOf[i];
+    }
+    return -1;
+}
+
+/* Function to find which of the k corners is at the place of v */
+int cornerAt(Vertex *v, int *corner, int k) {
+    int i;
+
+    for (i = 0; i < k && (vertices[corner[i]].x != v->x || vertices[corner[i]].y != v->y); i++);
+    return i;
+}
+
+/* Function to turn the list at input points start..end-1 into walls and
+a roof if it is a wireframe building: every point is a corner of one
+convex outline, each corner is at both the top and bottom height, and
+every segment lies on a wall or is level. The faces only hide what is
+behind them, so the building's lines are all kept as well. */
+void buildingFaces(int start, int end) {
+    int i, j, k = 0, a, p, q, corner[MAX_CORNERS], topV[MAX_CORNERS], bottomV[MAX_CORNERS], wall[4];
+    double top, bottom, cx = 0, cy = 0, angle[MAX_CORNERS], t;
+    Vertex *u, *v, *w;
+
+    for (i = start; i < end; i++)
+        if (vertexOf[i] < 0)
+            return;
+    top = bottom = vertices[vertexOf[start]].z;
+    for (i = start; i < end; i++) {
+        v = &vertices[vertexOf[i]];
+        top = v->z < top ? v->z : top; /* Z is negative upward. */
+        bottom = v->z > bottom ? v->z : bottom;
+        if (cornerAt(v, corner, k) == k) {
+            if (k == MAX_CORNERS)
+                return;
+            corner[k++] = vertexOf[i];
+        }
+    }
+    if (k < 3 || top == bottom)
+        return;
+
+    /* Order the corners round the outline. */
+    for (i = 0; i < k; i++) {
+        cx += vertices[corner[i]].x / k;
+        cy += vertices[corner[i]].y / k;
+    }
+    for (i = 0; i < k; i++) {
+        angle[i] = atan2(vertices[corner[i]].y - cy, vertices[corner[i]].x - cx);
+        for (j = i; j > 0 && angle[j - 1] > angle[j]; j--) {
+            t = angle[j]; angle[j] = angle[j - 1]; angle[j - 1] = t;
+            a = corner[j]; corner[j] = corner[j - 1]; corner[j - 1] = a;
+        }
+    }
+    for (i = 0; i < k; i++) {
+        u = &vertices[corner[i]];
+        v = &vertices[corner[(i + 1) % k]];
+        w = &vertices[corner[(i + 2) % k]];
+        if ((v->x - u->x) * (w->y - v->y) - (v->y - u->y) * (w->x - v->x) <= 0)
+            return; /* Not convex. */
+        topV[i] = findInList(start, end, u->x, u->y, top);
+        bottomV[i] = findInList(start, end, u->x, u->y, bottom);
+        if (topV[i] < 0 || bottomV[i] < 0)
+            return;
+    }
+    for (i = start + 1; i < end; i++) {
+        u = &vertices[vertexOf[i - 1]];
+        v = &vertices[vertexOf[i]];
+        p = cornerAt(u, corner, k);
+        q = cornerAt(v, corner, k);
+        if (p != q && (q - p + k) % k != 1 && (p - q + k) % k != 1 && u->z != v->z)
+            return;
+    }
+
+    for (i = 0; i < k; i++) {
+        wall[0] = bottomV[i];
+        wall[1] = topV[i];
+        wall[2] = topV[(i + 1) % k];
+        wall[3] = bottomV[(i + 1) % k];
+        writeFace(wall, 4);
+    }
+    writeFace(topV, k);
+}
+
+/* Function to write the faces, leaving their points out of the lines */
+void writeFaces() {
+    int i, j, start = 0;
+
+    covered = calloc(num_points + 1, 1);
+    for (i = 0; i <= num_points; i++) {
+        if (i < num_points && !isBreak(&points[i].v))
+            continue;
+        if (i > start + 1) {
+            if (isFace(start, i)) {
+                for (j = start; j < i; j++) {
+                    printVertex(&points[j].v);
+                    covered[j] = 1;
+                }
+                printf("1 -1 0\n");
+                num_face_points += i - start + 1;
+                num_faces++;
+            } else if (makeFaces) {
+                buildingFaces(start, i);
+            }
+        }
+        start = i + 1;
+    }
+}
+
+/* Function to turn the input lists into a set of unique segments */
+void collectEdges() {
+    int i, a, b, listSegments = 0;
+
+    edges = malloc((num_points + 1) * sizeof *edges);
+
+    for (i = 0; i < num_points; i++) {
+        if (isBreak(&points[i].v)) {
+            num_breaks++;
+            num_input_lists += listSegments > 0;
+            listSegments = 0;
+            continue;
+        }
+        if (i == 0 || isBreak(&points[i - 1].v))
+            continue;
+        if (covered[i])
+            continue;
+        num_input_segments++;
+        listSegments++;
+        a = vertexOf[i - 1];
+        b = vertexOf[i];
+        if (a < 0 || b < 0) {
+            fprintf(stderr, "sceneopt: point %d snapped onto a 0 sum, segment dropped\n", a < 0 ? i : i + 1);
+            continue;
+        }
+        if (a == b)
+            continue; /* Zero length. */
+        edges[num_edges].a = a < b ? a : b;
+        edges[num_edges].b = a < b ? b : a;
+        num_edges++;
+    }
+    num_input_lists += listSegments > 0;
+
+    qsort(edges, num_edges, sizeof *edges, compareEdge);
+    for (a = i = 0; i < num_edges; i++)
+        if (!a || compareEdge(&edges[a - 1], &edges[i]))
+            edges[a++] = edges[i];
+    num_edges = a;
+}
+
+/* Function to index the segments at each vertex */
+void buildAdjacency() {
+    int *fill, i;
+
+    adjStart = calloc(num_vertices + 1, sizeof *adjStart);
+    adjEdge = malloc((2 * num_edges + 1) * sizeof *adjEdge);
+    fill = malloc((num_vertices + 1) * sizeof *fill);
+    edgeUsed = calloc(num_edges + 1, 1);
+
+    for (i = 0; i < num_edges; i++) {
+        adjStart[edges[i].a + 1]++;
+        adjStart[edges[i].b + 1]++;
+    }
+    for (i = 0; i < num_vertices; i++)
+        adjStart[i + 1] += adjStart[i];
+    memcpy(fill, adjStart, num_vertices * sizeof *fill);
+    for (i = 0; i < num_edges; i++) {
+        adjEdge[fill[edges[i].a]++] = i;
+        adjEdge[fill[edges[i].b]++] = i;
+    }
+    free(fill);
+}
+
+int otherEnd(int e, int v) {
+    return edges[e].a == v ? edges[e].b : edges[e].a;
+}
+
+int unusedDegree(int v) {
+    int i, n = 0;
+
+    for (i = adjStart[v]; i < adjStart[v + 1]; i++)
+        n += !edgeUsed[adjEdge[i]];
+    return n;
+}
+
+/* Function to pick the unused segment at v that goes most nearly straight
+on from prev, or -1 if v is a dead end */
+int nextEdge(int prev, int v) {
+    int i, e, w, best = -1;
+    double inX, inY, inZ, outX, outY, outZ, len, cosine, bestCosine = -2;
+
+    inX = vertices[v].x - vertices[prev].x;
+    inY = vertices[v].y - vertices[prev].y;
+    inZ = vertices[v].z - vertices[prev].z;
+    len = sqrt(inX * inX + inY * inY + inZ * inZ);
+
+    for (i = adjStart[v]; i < adjStart[v + 1]; i++) {
+        e = adjEdge[i];
+        if (edgeUsed[e])
+            continue;
+        w = otherEnd(e, v);
+        outX = vertices[w].x - vertices[v].x;
+        outY = vertices[w].y - vertices[v].y;
+        outZ = vertices[w].z - vertices[v].z;
+        cosine = (inX * outX + inY * outY + inZ * outZ) /
+                 (len * sqrt(outX * outX + outY * outY + outZ * outZ));
+        if (cosine > bestCosine) {
+            bestCosine = cosine;
+            best = e;
+        }
+    }
+    return best;
+}
+
+/* Distance from point p to the segment a..b. */
+double distanceToSegment(Vertex *p, Vertex *a, Vertex *b) {
+    double dx = b->x - a->x, dy = b->y - a->y, dz = b->z - a->z;
+    double px = p->x - a->x, py = p->y - a->y, pz = p->z - a->z;
+    double len2 = dx * dx + dy * dy + dz * dz, t;
+
+    t = len2 > 0 ? (px * dx + py * dy + pz * dz) / len2 : 0;
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    px -= t * dx;
+    py -= t * dy;
+    pz -= t * dz;
+    return sqrt(px * px + py * py + pz * pz);
+}
+
+/* Function to check that chain[from..to] can be drawn as one segment */
+int canMerge(int from, int to) {
+    Vertex *a = &vertices[chain[from]], *b = &vertices[chain[to]], *p, *q;
+    double dx = b->x - a->x, dy = b->y - a->y, dz = b->z - a->z, limit = maxLength, len;
+    int i;
+
+    if (maxLength < 0) {
+        for (limit = 0, i = from; i < to; i++) {
+            p = &vertices[chain[i]];
+            q = &vertices[chain[i + 1]];
+            len = sqrt((q->x - p->x) * (q->x - p->x) + (q->y - p->y) * (q->y - p->y) +
+                       (q->z - p->z) * (q->z - p->z));
+            limit = len > limit ? len : limit;
+        }
+    }
+    if (limit > 0 && dx * dx + dy * dy + dz * dz > limit * limit)
+        return 0;
+    for (i = from + 1; i < to; i++)
+        if (distanceToSegment(&vertices[chain[i]], a, b) > collinearEps)
+            return 0;
+    return 1;
+}
+
+/* Function to write the walked chain, leaving out collinear points */
+void writeChain() {
+    int kept = 0, i;
+
+    writeVertex(&vertices[chain[0]]);
+    for (i = 1; i < chainLen; i++) {
+        if (i + 1 < chainLen && canMerge(kept, i + 1))
+            continue;
+        writeVertex(&vertices[chain[i]]);
+        num_out_segments++;
+        kept = i;
+    }
+    printf("0 0 0\n");
+    num_out_points++;
+    num_out_lists++;
+}
+
+/* Function to walk unused segments from the first edge path[0]..path[1],
+appending to path until a dead end. Returns the new length. */
+int walkFrom(int *path, int len) {
+    int e, v = path[len - 1], prev = path[len - 2];
+
+    while ((e = nextEdge(prev, v)) >= 0) {
+        edgeUsed[e] = 1;
+        prev = v;
+        v = otherEnd(e, v);
+        path[len++] = v;
+    }
+    return len;
+}
+
+/* Function to take an unused segment at v and walk on from it, choosing
+the one straightest on from prev if there is a prev. Returns the length. */
+int startWalk(int *path, int prev, int v) {
+    int i, e;
+
+    if (prev >= 0)
+        e = nextEdge(prev, v);
+    else
+        for (i = adjStart[v]; edgeUsed[e = adjEdge[i]]; i++);
+    edgeUsed[e] = 1;
+    path[0] = v;
+    path[1] = otherEnd(e, v);
+    return walkFrom(path, 2);
+}
+
+/* Function to splice every loop still hanging off path p into it */
+void spliceLoops(int p) {
+    int i, j, loopLen;
+
+    for (i = pathStart[p]; i < pathStart[p + 1]; i++) {
+        while (unusedDegree(paths[i])) {
+            loopLen = startWalk(loop, i > pathStart[p] ? paths[i - 1] : -1, paths[i]) - 1;
+            memmove(paths + i + loopLen, paths + i, (pathStart[num_paths] - i) * sizeof *paths);
+            memcpy(paths + i, loop, loopLen * sizeof *paths);
+            for (j = p + 1; j <= num_paths; j++)
+                pathStart[j] += loopLen;
+        }
+    }
+}
+
+/* Function to start a new path at v */
+void addPath(int v) {
+    pathStart[num_paths + 1] = pathStart[num_paths] + startWalk(paths + pathStart[num_paths], -1, v);
+    num_paths++;
+}
+
+/* Function to cover all segments with as few polylines as we can.
+
+Open paths must start at odd-degree vertices, and a walk from one always
+ends at another. Once those are all out, every vertex has an even number
+of unused segments left, so anything left at a vertex on a path is a loop
+back to it, which gets spliced into the path there (Hierholzer). What's
+still left after that are loops on their own. */
+void stitchAndWrite() {
+    int p, v;
+
+    paths = malloc((2 * num_edges + 2) * sizeof *paths);
+    pathStart = calloc(num_edges + 2, sizeof *pathStart);
+    loop = malloc((num_edges + 2) * sizeof *loop);
+
+    for (v = 0; v < num_vertices; v++)
+        while (unusedDegree(v) % 2)
+            addPath(v);
+
+    for (p = 0; p < num_paths; p++)
+        spliceLoops(p);
+
+    for (v = 0; v < num_vertices; v++) {
+        if (unusedDegree(v)) {
+            addPath(v);
+            spliceLoops(num_paths - 1);
+        }
+    }
+
+    for (p = 0; p < num_paths; p++) {
+        chain = paths + pathStart[p];
+        chainLen = pathStart[p + 1] - pathStart[p];
+        writeChain();
+    }
+}
+
+/* Function to read the command line options */
+void parseOptions(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:e:l:f")) != -1) {
+        switch (opt) {
+            case 'w':
+                weldGrid = atof(optarg);
+                break;
+            case 'e':
+                collinearEps = atof(optarg);
+                break;
+            case 'l':
+                maxLength = atof(optarg);
+                break;
+            case 'f':
+                makeFaces = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-w weld_grid] [-e collinear_eps] [-l max_length] [-f] [file.scene ...]\n", argv[0]);
+                exit(2);
+        }
+    }
+}
+
+/* Main function */
+int main(int argc, char **argv) {
+    FILE *f;
+    int i;
+
+    parseOptions(argc, argv);
+
+    if (optind == argc)
+        readScene(stdin);
+    for (i = optind; i < argc; i++) {
+        f = fopen(argv[i], "r");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        readScene(f);
+        fclose(f);
+    }
+
+    weldVertices();
+    writeFaces();
+    collectEdges();
+    buildAdjacency();
+    stitchAndWrite();
+
+    fprintf(stderr, "           points  segments  polylines\n");
+    fprintf(stderr, "before  %9d %9d %10d\n", num_points, num_input_segments, num_input_lists);
+    fprintf(stderr, "after   %9d %9d %10d\n", num_out_points, num_out_segments, num_out_lists);
+    fprintf(stderr, "(%d unique vertices, %d unique segments)\n", num_vertices, num_edges);
+    if (num_faces)
+        fprintf(stderr, "faces   %9d points in %d faces\n", num_face_points, num_faces);
+    return 0;
+}
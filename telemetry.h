@@ -0,0 +1,77 @@
+/* Flight state published by banks every physics tick.
+
+banks keeps one TelemetryPage in POSIX shared memory under
+TELEMETRY_SHM_NAME and rewrites its state every 0.02 s tick, guarded by
+a seqlock: the writer makes seq odd, writes the state, then makes seq even
+again. Readers never block the writer and need no syscalls; they copy the
+state and keep the copy only if seq was the same even number before and
+after. A reader that wants every tick checks that state.tick went up by
+one; the page only ever holds the latest tick.
+
+Readers must check magic and version before trusting anything else.
+version goes up whenever TelemetryState changes layout; fields are only
+ever added at the end, so size tells a reader what it got. */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#define TELEMETRY_SHM_NAME "/banks-telemetry"
+#define TELEMETRY_MAGIC 0x4b4e4142 /* "BANK" little-endian */
+#define TELEMETRY_VERSION 1
+
+typedef struct {
+    uint64_t tick;          /* Physics ticks since start. */
+    int64_t  monoNanos;     /* CLOCK_MONOTONIC when published. */
+    double   simSeconds;    /* tick * dt */
+
+    double   x, y;          /* airplaneX, airplaneY, feet. */
+    double   altitude;      /* airplaneZ, feet, positive upward. */
+
+    double   heading;       /* compassRadians, 0 = North. */
+    double   pitch;         /* forwardTiltRadians, positive climbing. */
+    double   roll;          /* sideTiltRadians, positive right wing down. */
+    double   rotation[3][3]; /* R11..R33, world to airplane. */
+
+    double   speedFeet;     /* Airspeed, feet/sec. */
+    int32_t  speedKnots;    /* As shown on the HUD. */
+
+    int32_t  pad;
+    double   throttle;      /* speed, PageUp/PageDn. */
+    double   stickUpDown;   /* up_down, Up/Down arrows. */
+    double   stickLeftRight; /* left_right, Left/Right arrows. */
+} TelemetryState;
+
+typedef struct {
+    uint32_t magic;         /* TELEMETRY_MAGIC once the page is set up. */
+    uint32_t version;       /* TELEMETRY_VERSION of the writer. */
+    uint32_t size;          /* sizeof(TelemetryState) of the writer. */
+    uint32_t seq;           /* Seqlock; odd while state is being written. */
+    char     pad[48];       /* Keep state off the seq cache line. */
+    TelemetryState state;
+} TelemetryPage;
+
+/* Function to publish a new state. Single writer only. */
+static __inline__ void telemetryWrite(TelemetryPage *page, const TelemetryState *state) {
+    uint32_t seq = page->seq;
+
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->state = *state;
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Function to copy out the latest state. Returns the seq it was read at,
+or 0 if the writer was mid-update or has published nothing yet. */
+static __inline__ uint32_t telemetryRead(const TelemetryPage *page, TelemetryState *state) {
+    uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+
+    if (seq & 1)
+        return 0;
+    *state = page->state;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq ? seq : 0;
+}
+
+#endif
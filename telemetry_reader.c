@@ -0,0 +1,182 @@
+/* Telemetry reader for banks.
+
+Attaches to the shared memory page banks publishes every physics tick
+(see telemetry.h), prints the flight state once a second and measures how
+long each tick took to get here: the time from banks stamping the state
+to this reader holding a consistent copy of it.
+
+By default it spins on the seqlock, which costs a core but no syscalls,
+so the numbers are the hand-off itself. -p sleeps between polls instead;
+the latency then includes the sleep.
+
+Compile:
+
+gcc -ansi telemetry_reader.c -lrt -o telemetry_reader
+
+or on macOS, which has no librt:
+
+gcc-14 telemetry_reader.c -std=gnu89 -o telemetry_reader
+
+Run (with banks running):
+
+./telemetry_reader [-p poll_usecs] [-n seconds]
+
+*/
+
+#define _XOPEN_SOURCE 600 /* shm_open, clock_gettime and getopt under -ansi */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "telemetry.h"
+
+#define BUCKET_NANOS 100   /* Latency histogram resolution. */
+#define NUM_BUCKETS 10000  /* Up to 1 ms; slower ticks land in the last one. */
+
+long pollMicros, runSeconds;
+
+long histogram[NUM_BUCKETS];
+long received, missed;
+int64_t minNanos, maxNanos, totalNanos;
+
+int64_t monotonicNanos() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * (int64_t)1000000000 + now.tv_nsec;
+}
+
+/* Function to wait for banks to set up the page and map it */
+const TelemetryPage *attach() {
+    const TelemetryPage *page;
+    struct timespec retry = {0, 100000000};
+    int fd, waiting = 0;
+    void *p;
+
+    for (;;) {
+        fd = shm_open(TELEMETRY_SHM_NAME, O_RDONLY, 0);
+        if (fd >= 0) {
+            p = mmap(0, sizeof *page, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p != MAP_FAILED) {
+                page = p;
+                if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) == TELEMETRY_MAGIC)
+                    break;
+                munmap(p, sizeof *page);
+            }
+        }
+        if (!waiting++)
+            fprintf(stderr, "waiting for banks to publish %s...\n", TELEMETRY_SHM_NAME);
+        nanosleep(&retry, 0);
+    }
+
+    if (page->version != TELEMETRY_VERSION || page->size < sizeof page->state) {
+        fprintf(stderr, "telemetry_reader: page is version %u size %u, want version %d size %d\n",
+                page->version, page->size, TELEMETRY_VERSION, (int)sizeof page->state);
+        exit(1);
+    }
+    return page;
+}
+
+/* Function to find the latency below which a fraction of ticks arrived */
+double percentileMicros(double fraction) {
+    long want = received * fraction, seen = 0;
+    int i;
+
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > want)
+            break;
+    }
+    return (i + 1) * BUCKET_NANOS / 1e3;
+}
+
+/* Function to print a second's worth of state and latency, then reset */
+void report(const TelemetryState *s) {
+    printf("tick %8lu  x %8.0f  y %8.0f  alt %6.0f  hdg %3d  kts %4d | "
+           "%3ld ticks %ld missed  latency us min %.2f avg %.2f p50 %.1f p99 %.1f max %.2f\n",
+           (unsigned long)s->tick, s->x, s->y, s->altitude,
+           ((int)(s->heading * 57.3) % 360 + 360) % 360, (int)s->speedKnots,
+           received, missed, minNanos / 1e3, received ? totalNanos / 1e3 / received : 0,
+           percentileMicros(0.5), percentileMicros(0.99), maxNanos / 1e3);
+    fflush(stdout);
+
+    memset(histogram, 0, sizeof histogram);
+    received = missed = 0;
+    minNanos = maxNanos = totalNanos = 0;
+}
+
+/* Function to read the command line options */
+void parseOptions(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+        switch (opt) {
+            case 'p':
+                pollMicros = atol(optarg);
+                break;
+            case 'n':
+                runSeconds = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p poll_usecs] [-n seconds]\n", argv[0]);
+                exit(2);
+        }
+    }
+}
+
+/* Main function */
+int main(int argc, char **argv) {
+    const TelemetryPage *page;
+    TelemetryState state, latest;
+    struct timespec poll;
+    uint32_t seq, lastSeq = 0;
+    uint64_t lastTick = 0;
+    int64_t now, latency, nextReport, stop;
+
+    parseOptions(argc, argv);
+    poll.tv_sec = pollMicros / 1000000;
+    poll.tv_nsec = pollMicros % 1000000 * 1000;
+
+    page = attach();
+
+    nextReport = monotonicNanos() + 1000000000;
+    stop = runSeconds ? nextReport + (runSeconds - 1) * (int64_t)1000000000 : 0;
+
+    for (;;) {
+        seq = telemetryRead(page, &state);
+        now = monotonicNanos();
+
+        if (seq && seq != lastSeq) {
+            lastSeq = seq;
+            latest = state;
+            latency = now - state.monoNanos;
+            if (lastTick && state.tick > lastTick + 1)
+                missed += state.tick - lastTick - 1;
+            lastTick = state.tick;
+
+            if (!received || latency < minNanos)
+                minNanos = latency;
+            if (latency > maxNanos)
+                maxNanos = latency;
+            totalNanos += latency;
+            histogram[latency / BUCKET_NANOS < NUM_BUCKETS ? latency / BUCKET_NANOS : NUM_BUCKETS - 1]++;
+            received++;
+        }
+
+        if (now >= nextReport) {
+            if (lastTick)
+                report(&latest);
+            if (stop && now >= stop)
+                return 0;
+            nextReport += 1000000000;
+        }
+
+        if (pollMicros)
+            nanosleep(&poll, 0);
+    }
+}